@@ -0,0 +1,257 @@
+#include "activation.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/*
+exp(x) = 2^k * exp(r) with k = round(x / ln2) and |r| <= ln2/2,
+exp(r) comes from its Taylor polynomial, long enough that the relative error
+stays below 1e-14 for doubles and 3e-7 for floats, inputs are clamped to keep results finite
+*/
+template <class T> struct ExpConstants;
+template <> struct ExpConstants<double> {
+    static constexpr double limit = 708.0; // 2^k stays a normal number
+    static constexpr double log2e = 1.4426950408889634;
+    static constexpr double ln2High = 0.693145751953125; // exact in few bits, so k*ln2High is exact
+    static constexpr double ln2Low = 1.42860682030941723212e-6;
+    static constexpr int degree = 11;
+    static constexpr double coefficients[degree+1] = {1/39916800.0, 1/3628800.0, 1/362880.0, 1/40320.0,
+        1/5040.0, 1/720.0, 1/120.0, 1/24.0, 1/6.0, 1/2.0, 1.0, 1.0};
+};
+template <> struct ExpConstants<float> {
+    static constexpr float limit = 87.0f;
+    static constexpr float log2e = 1.44269504f;
+    static constexpr float ln2High = 0.693359375f;
+    static constexpr float ln2Low = -2.12194440e-4f;
+    static constexpr int degree = 6;
+    static constexpr float coefficients[degree+1] = {1/720.0f, 1/120.0f, 1/24.0f, 1/6.0f, 1/2.0f, 1.0f, 1.0f};
+};
+
+// Scalar exp approximation, also used for the elements after the last full vector
+template <class T>
+static inline T exp_approx(T x) {
+    typedef ExpConstants<T> C;
+    x = x > -C::limit ? x : -C::limit; // NaN clamps low, like the vector max
+    x = x < C::limit ? x : C::limit;
+    T k = std::nearbyint(x * C::log2e);
+    T r = std::fma(-k, C::ln2Low, std::fma(-k, C::ln2High, x));
+    T p = C::coefficients[0];
+    for (int i=1; i<=C::degree; i++) p = std::fma(p, r, C::coefficients[i]);
+
+    // build 2^k straight from its exponent bits
+    T scale;
+    if constexpr (sizeof(T) == 8) {
+        int64_t bits = ((int64_t)k + 1023) << 52;
+        std::memcpy(&scale, &bits, sizeof(scale));
+    } else {
+        int32_t bits = ((int32_t)k + 127) << 23;
+        std::memcpy(&scale, &bits, sizeof(scale));
+    }
+    return p * scale;
+}
+
+#ifdef __AVX2__
+// Overloads that let the activations be written once for both vector widths
+static inline __m256d load(const double* p) {return _mm256_loadu_pd(p);}
+static inline __m256 load(const float* p) {return _mm256_loadu_ps(p);}
+static inline void store(double* p, __m256d x) {_mm256_storeu_pd(p, x);}
+static inline void store(float* p, __m256 x) {_mm256_storeu_ps(p, x);}
+static inline __m256d broadcast(double x) {return _mm256_set1_pd(x);}
+static inline __m256 broadcast(float x) {return _mm256_set1_ps(x);}
+static inline __m256d add(__m256d a, __m256d b) {return _mm256_add_pd(a, b);}
+static inline __m256 add(__m256 a, __m256 b) {return _mm256_add_ps(a, b);}
+static inline __m256d mul(__m256d a, __m256d b) {return _mm256_mul_pd(a, b);}
+static inline __m256 mul(__m256 a, __m256 b) {return _mm256_mul_ps(a, b);}
+static inline __m256d div(__m256d a, __m256d b) {return _mm256_div_pd(a, b);}
+static inline __m256 div(__m256 a, __m256 b) {return _mm256_div_ps(a, b);}
+static inline __m256d max(__m256d a, __m256d b) {return _mm256_max_pd(a, b);}
+static inline __m256 max(__m256 a, __m256 b) {return _mm256_max_ps(a, b);}
+static inline __m256d min(__m256d a, __m256d b) {return _mm256_min_pd(a, b);}
+static inline __m256 min(__m256 a, __m256 b) {return _mm256_min_ps(a, b);}
+static inline __m256d fmadd(__m256d a, __m256d b, __m256d c) {return _mm256_fmadd_pd(a, b, c);}
+static inline __m256 fmadd(__m256 a, __m256 b, __m256 c) {return _mm256_fmadd_ps(a, b, c);}
+static inline __m256d fnmadd(__m256d a, __m256d b, __m256d c) {return _mm256_fnmadd_pd(a, b, c);}
+static inline __m256 fnmadd(__m256 a, __m256 b, __m256 c) {return _mm256_fnmadd_ps(a, b, c);}
+static inline __m256d round(__m256d x) {return _mm256_round_pd(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);}
+static inline __m256 round(__m256 x) {return _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);}
+static inline __m256d exp2_int(__m256d k) {
+    __m256i bits = _mm256_add_epi64(_mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(k)), _mm256_set1_epi64x(1023));
+    return _mm256_castsi256_pd(_mm256_slli_epi64(bits, 52));
+}
+static inline __m256 exp2_int(__m256 k) {
+    __m256i bits = _mm256_add_epi32(_mm256_cvtps_epi32(k), _mm256_set1_epi32(127));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(bits, 23));
+}
+
+// Vector exp approximation, the same steps as the scalar one
+template <class T, class V>
+static inline V exp_approx(V x) {
+    typedef ExpConstants<T> C;
+    x = min(max(x, broadcast(-C::limit)), broadcast(C::limit));
+    V k = round(mul(x, broadcast(C::log2e)));
+    V r = fnmadd(k, broadcast(C::ln2Low), fnmadd(k, broadcast(C::ln2High), x));
+    V p = broadcast(C::coefficients[0]);
+    for (int i=1; i<=C::degree; i++) p = fmadd(p, r, broadcast(C::coefficients[i]));
+    return mul(p, exp2_int(k));
+}
+
+// Vector types and lane counts for each precision
+template <class T> struct Lanes;
+template <> struct Lanes<double> {typedef __m256d Vector; static const size_t width = 4;};
+template <> struct Lanes<float> {typedef __m256 Vector; static const size_t width = 8;};
+#endif
+
+// Apply f to every element, with vectorf doing full vectors of them
+template <class T, class Scalar, class Vector>
+static inline void for_each_lane(T* x, size_t count, Scalar f, Vector vectorf) {
+    size_t i = 0;
+#ifdef __AVX2__
+    const size_t width = Lanes<T>::width;
+    for (; i+width<=count; i+=width)
+        store(x + i, vectorf(load(x + i)));
+#else
+    (void)vectorf;
+#endif
+    for (; i<count; i++)
+        x[i] = f(x[i]);
+}
+
+template <class T>
+static void exp_in_place(T* x, size_t count) {
+#ifdef __AVX2__
+    typedef typename Lanes<T>::Vector V;
+    for_each_lane(x, count, [](T v) {return exp_approx(v);}, [](V v) {return exp_approx<T>(v);});
+#else
+    for_each_lane(x, count, [](T v) {return exp_approx(v);}, 0);
+#endif
+}
+
+// Normalize one row to probabilities, shifted by its maximum so exp can't overflow
+template <class T>
+static void softmax(T* x, size_t count) {
+    T maximum = *std::max_element(x, x + count);
+    for (size_t i=0; i<count; i++) x[i] -= maximum;
+    exp_in_place(x, count);
+    T sum = 0;
+    for (size_t i=0; i<count; i++) sum += x[i];
+    T inverse = 1 / sum;
+    for (size_t i=0; i<count; i++) x[i] *= inverse;
+}
+
+template <class T>
+static void activate_values(Activation activation, T* x, size_t cols, size_t rows) {
+    size_t count = cols * rows;
+    switch (activation) {
+        case SIGMOID:
+            // 1 / (1 + exp(-x))
+#ifdef __AVX2__
+            for_each_lane(x, count, [](T v) {return 1 / (1 + exp_approx(-v));},
+                [](typename Lanes<T>::Vector v) {
+                    auto one = broadcast((T)1);
+                    return div(one, add(one, exp_approx<T>(mul(v, broadcast((T)-1)))));
+                });
+#else
+            for_each_lane(x, count, [](T v) {return 1 / (1 + exp_approx(-v));}, 0);
+#endif
+            break;
+        case TANH:
+            // 2 / (1 + exp(-2x)) - 1
+#ifdef __AVX2__
+            for_each_lane(x, count, [](T v) {return 2 / (1 + exp_approx(-2*v)) - 1;},
+                [](typename Lanes<T>::Vector v) {
+                    auto one = broadcast((T)1), two = broadcast((T)2);
+                    return add(div(two, add(one, exp_approx<T>(mul(v, broadcast((T)-2))))), broadcast((T)-1));
+                });
+#else
+            for_each_lane(x, count, [](T v) {return 2 / (1 + exp_approx(-2*v)) - 1;}, 0);
+#endif
+            break;
+        case RELU:
+#ifdef __AVX2__
+            for_each_lane(x, count, [](T v) {return v > 0 ? v : 0;},
+                [](typename Lanes<T>::Vector v) {return max(v, broadcast((T)0));});
+#else
+            for_each_lane(x, count, [](T v) {return v > 0 ? v : 0;}, 0);
+#endif
+            break;
+        case SOFTMAX:
+            for (size_t r=0; r<rows; r++) softmax(x + r*cols, cols);
+            break;
+    }
+}
+
+// Apply an activation in place to rows of cols weighted sums
+void activate(Activation activation, double* x, size_t cols, size_t rows) {
+    activate_values(activation, x, cols, rows);
+}
+void activate(Activation activation, float* x, size_t cols, size_t rows) {
+    activate_values(activation, x, cols, rows);
+}
+
+// Chain the loss gradient through the derivative of the activation, written in terms of its outputs
+void activation_backward(Activation activation, const double* y, double* delta, size_t count) {
+    switch (activation) {
+        case SIGMOID:
+            for (size_t i=0; i<count; i++) delta[i] *= y[i] * (1 - y[i]);
+            break;
+        case TANH:
+            for (size_t i=0; i<count; i++) delta[i] *= 1 - y[i]*y[i];
+            break;
+        case RELU:
+            for (size_t i=0; i<count; i++) delta[i] = y[i] > 0 ? delta[i] : 0.0;
+            break;
+        case SOFTMAX: {
+            // every output depends on every input, delta_i = y_i * (delta_i - sum_j delta_j y_j)
+            double weighted = 0.0;
+            for (size_t i=0; i<count; i++) weighted += delta[i] * y[i];
+            for (size_t i=0; i<count; i++) delta[i] = y[i] * (delta[i] - weighted);
+            break;
+        }
+    }
+}
+
+// Squared error against a one-hot target
+double squared_error(const double* y, size_t label, size_t count) {
+    double loss = 0.0;
+    for (size_t i=0; i<count; i++) {
+        double error = y[i] - (i == label ? 1.0 : 0.0);
+        loss += error * error;
+    }
+    return loss;
+}
+
+// Fused softmax cross-entropy, the shift by the maximum keeps exp from overflowing
+// and the log of the label's probability is taken from the shifted sums, so it can't underflow
+double softmax_cross_entropy(double* z, size_t label, double* delta, size_t count) {
+    double maximum = *std::max_element(z, z + count);
+    for (size_t i=0; i<count; i++) z[i] -= maximum;
+    double shifted = label < count ? z[label] : 0.0;
+    exp_in_place(z, count);
+    double sum = 0.0;
+    for (size_t i=0; i<count; i++) sum += z[i];
+
+    double inverse = 1 / sum;
+    for (size_t i=0; i<count; i++) {
+        z[i] *= inverse;
+        delta[i] = z[i];
+    }
+    if (label < count) delta[label] -= 1.0;
+    return std::log(sum) - shifted;
+}
+
+// Names of the activations, in enum order
+static const char* ACTIVATION_NAMES[] = {"sigmoid", "relu", "tanh", "softmax"};
+
+const char* activation_name(Activation activation) {
+    return ACTIVATION_NAMES[activation];
+}
+Activation parse_activation(const std::string& name) {
+    for (size_t i=0; i<sizeof(ACTIVATION_NAMES)/sizeof(*ACTIVATION_NAMES); i++)
+        if (name == ACTIVATION_NAMES[i]) return (Activation)i;
+    throw std::invalid_argument("unknown activation '" + name + "'");
+}
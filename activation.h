@@ -0,0 +1,32 @@
+#ifndef ACTIVATION_H
+#define ACTIVATION_H
+
+#include <string>
+#include <cstddef>
+
+// Function applied to the weighted sums of a layer's nodes
+enum Activation {SIGMOID, RELU, TANH, SOFTMAX};
+
+// Name of an activation as written in the resize command, eg. "relu"
+const char* activation_name(Activation activation);
+// Activation with the given name, throws std::invalid_argument for an unknown one
+Activation parse_activation(const std::string& name);
+
+// Apply an activation in place to rows of cols weighted sums, stored contiguously
+// softmax normalizes each row on its own, the others treat every value alike
+void activate(Activation activation, double* x, size_t cols, size_t rows=1);
+void activate(Activation activation, float* x, size_t cols, size_t rows=1);
+
+// Turn the loss gradient with respect to a layer's outputs y into the gradient
+// with respect to its weighted sums, in place
+void activation_backward(Activation activation, const double* y, double* delta, size_t count);
+
+// Squared error of one instance given the outputs y of the output layer, without building a one-hot target
+// softmax outputs take softmax_cross_entropy instead
+double squared_error(const double* y, size_t label, size_t count);
+// Softmax and cross-entropy fused into one numerically stable pass over the weighted sums z:
+// z becomes the softmax outputs in place, delta the loss gradient with respect to z (y - onehot),
+// and the loss is returned as log(sum exp(z - max)) - (z[label] - max)
+double softmax_cross_entropy(double* z, size_t label, double* delta, size_t count);
+
+#endif
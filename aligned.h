@@ -0,0 +1,34 @@
+#ifndef ALIGNED_H
+#define ALIGNED_H
+
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+// Allocator that places storage on cache line boundaries for vectorized loops
+template <typename T, size_t Alignment = 64>
+struct AlignedAllocator {
+    public:
+        typedef T value_type;
+        template <typename U> struct rebind {typedef AlignedAllocator<U, Alignment> other;};
+
+        AlignedAllocator() noexcept {}
+        template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+        T* allocate(size_t n) {
+            // aligned_alloc needs the size to be a multiple of the alignment
+            size_t bytes = (n*sizeof(T) + Alignment-1) / Alignment * Alignment;
+            void* ptr = std::aligned_alloc(Alignment, bytes ? bytes : Alignment);
+            if (!ptr) throw std::bad_alloc();
+            return static_cast<T*>(ptr);
+        }
+        void deallocate(T* ptr, size_t) noexcept {std::free(ptr);}
+
+        template <typename U> bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept {return true;}
+        template <typename U> bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept {return false;}
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+#endif
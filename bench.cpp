@@ -0,0 +1,239 @@
+#include "config.h"
+#include "neural_network.h"
+#include "dataset.h"
+#include "static_network.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+/*
+Benchmarks of the hot paths, printed as a JSON array
+  ./bench [min seconds per benchmark] > results.json
+*/
+
+// Count every heap allocation so allocations per op can be reported
+static std::atomic<size_t> allocations(0);
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+void operator delete(void* ptr) noexcept {std::free(ptr);}
+void operator delete(void* ptr, size_t) noexcept {std::free(ptr);}
+
+// Result of a single benchmark
+struct BenchResult {
+    public:
+        std::string name;
+        std::string params;
+        size_t ops;
+        double nsPerOp;
+        double samplesPerSec;
+        double allocsPerOp;
+};
+
+static double min_seconds = 0.2;
+static std::vector<BenchResult> results;
+
+// Keep the optimizer from throwing away benchmarked work
+static volatile double sink;
+
+// Time op until min_seconds have passed, each op processing samplesPerOp samples
+static void bench(const std::string& name, const std::string& params, size_t samplesPerOp,
+    const std::function<void()>& op) {
+    using clock = std::chrono::steady_clock;
+    op(); // warm up caches and lazily sized buffers
+
+    size_t ops = 0;
+    size_t allocations_before = allocations.load();
+    auto start = clock::now();
+    double elapsed = 0.0;
+    for (size_t batch=1; elapsed < min_seconds; batch*=2) {
+        for (size_t i=0; i<batch; i++) op();
+        ops += batch;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    }
+    size_t allocated = allocations.load() - allocations_before;
+
+    results.push_back(BenchResult{name, params, ops, elapsed*1e9/ops, ops*samplesPerOp/elapsed,
+        (double)allocated/ops});
+    fprintf(stderr, "%-24s %-32s %12.1f ns/op\n", name.c_str(), params.c_str(), elapsed*1e9/ops);
+}
+
+// Layer sizes as text, eg. "4-5-3"
+static std::string describe(const std::vector<size_t>& sizes) {
+    std::string text;
+    for (auto size : sizes) text += (text.empty() ? "" : "-") + std::to_string(size);
+    return text;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) min_seconds = std::atof(argv[1]);
+
+    // single layers and whole networks over a range of widths
+    for (auto sizes : std::vector<std::vector<size_t>> {{4, 5}, {64, 64}, {256, 256}, {1024, 1024}}) {
+        Layer layer(sizes[1], sizes[0]);
+        std::vector<double> input(sizes[0], 0.5), output(sizes[1]);
+        bench("Layer::calculate", describe(sizes), 1, [&]() {
+            layer.calculate(input.data(), output.data());
+            sink = output[0];
+        });
+
+        // reduced precision kernels
+        layer.quantize(1.0);
+        std::vector<float> input32(sizes[0], 0.5f), output32(sizes[1]);
+        AlignedVector<int8_t> input8(layer.stride8, 0);
+        std::fill(input8.begin(), input8.begin() + sizes[0], 64);
+        bench("Layer::calculate float32", describe(sizes), 1, [&]() {
+            layer.calculate(input32.data(), output32.data());
+            sink = output32[0];
+        });
+        bench("Layer::calculate int8", describe(sizes), 1, [&]() {
+            layer.calculate(input8.data(), output32.data());
+            sink = output32[0];
+        });
+    }
+    // dense and sparse kernels of a layer's weights over a range of densities, for placing SPARSE_DENSITY
+    for (size_t width : {256, 1024}) {
+        Layer layer(width, width);
+        Matrix batch(64, width), output(64, width);
+        for (auto& x : batch.data) x = 0.5;
+        std::string params = std::to_string(width) + "-" + std::to_string(width);
+        bench("dot", params, 1, [&]() {
+            for (size_t i=0; i<width; i++) output.data[i] = dot(&layer.weights[i*width], batch[0], width);
+            sink = output.data[0];
+        });
+        bench("multiply_transposed", params + " batch 64", 64, [&]() {
+            multiply_transposed(batch.data.data(), layer.weights.data(), output.data.data(), 64, width, width);
+            sink = output.data[0];
+        });
+        for (double density : {0.9, 0.7, 0.5, 0.3, 0.2, 0.1}) {
+            layer.prune(layer.sparsity_threshold(1 - density));
+            std::string sparse_params = params + " density " + std::to_string(density).substr(0, 3);
+            bench("SparseMatrix::dot", sparse_params, 1, [&]() {
+                for (size_t i=0; i<width; i++) output.data[i] = layer.sparse.dot(i, batch[0]);
+                sink = output.data[0];
+            });
+            bench("multiply_transposed sparse", sparse_params + " batch 64", 64, [&]() {
+                multiply_transposed(batch.data.data(), layer.sparse, output.data.data(), 64);
+                sink = output.data[0];
+            });
+        }
+    }
+    for (auto sizes : std::vector<std::vector<size_t>> {{4, 5, 3}, {11, 64, 7}, {64, 256, 256, 10}}) {
+        NeuralNetwork nn(sizes);
+        std::vector<double> input(sizes[0], 0.5);
+        bench("NeuralNetwork::calculate", describe(sizes), 1, [&]() {
+            sink = nn.calculate(input)[0];
+        });
+
+        // a batch through every precision, int8 pays for quantizing between layers and wins once they are wide
+        Matrix batch(256, sizes[0]);
+        for (auto& x : batch.data) x = 0.5;
+        for (auto layer : nn.layers) if (layer->numInputs) layer->quantize(1.0);
+        const char* names[] = {"float64", "float32", "int8"};
+        for (Precision precision : {FLOAT64, FLOAT32, INT8}) {
+            bench("NeuralNetwork::calculate_batch", describe(sizes) + " batch 256 " + names[precision], batch.rows, [&]() {
+                sink = nn.calculate_batch(batch, precision).data[0];
+            });
+        }
+    }
+    {
+        // the same small topologies specialized at compile time
+        StaticNetwork<4, 5, 3> iris;
+        StaticNetwork<11, 64, 7> wine;
+        std::vector<double> input(11, 0.5), output(7);
+        bench("StaticNetwork::calculate", "4-5-3", 1, [&]() {
+            iris.calculate(input.data(), output.data());
+            sink = output[0];
+        });
+        bench("StaticNetwork::calculate", "11-64-7", 1, [&]() {
+            wine.calculate(input.data(), output.data());
+            sink = output[0];
+        });
+
+        // batches go through sample-minor blocks, compare with the float64 rows of NeuralNetwork::calculate_batch
+        Matrix iris_batch(256, 4), wine_batch(256, 11);
+        for (auto& x : iris_batch.data) x = 0.5;
+        for (auto& x : wine_batch.data) x = 0.5;
+        bench("StaticNetwork::calculate_batch", "4-5-3 batch 256", iris_batch.rows, [&]() {
+            sink = iris.calculate_batch(iris_batch).data[0];
+        });
+        bench("StaticNetwork::calculate_batch", "11-64-7 batch 256", wine_batch.rows, [&]() {
+            sink = wine.calculate_batch(wine_batch).data[0];
+        });
+    }
+
+    // training and evaluation on every bundled dataset
+    for (std::string filename : {"datasets/iris.csv", "datasets/imbalanced_iris.csv",
+        "datasets/wine.csv", "datasets/diabetes.csv"}) {
+        CsvSchema schema;
+        Dataset dataset;
+        bench("get_dataset", filename, 0, [&]() {
+            dataset = get_dataset(filename, schema);
+        });
+        results.back().samplesPerSec = dataset.size() * 1e9 / results.back().nsPerOp;
+
+        std::vector<size_t> sizes = {dataset.numFeatures(), 16, dataset.classes.size()};
+        NeuralNetwork nn(sizes);
+        std::string params = filename + " " + describe(sizes);
+        bench("NeuralNetwork::loss", params, dataset.size(), [&]() {
+            sink = nn.loss(dataset);
+        });
+        bench("NeuralNetwork::learn", params, dataset.size(), [&]() {
+            nn.learn(dataset, 0.01);
+        });
+        bench("NeuralNetwork::test", params, dataset.size(), [&]() {
+            sink = nn.test(dataset);
+        });
+        bench("NeuralNetwork::evaluate", params, dataset.size(), [&]() {
+            sink = nn.evaluate(dataset).loss();
+        });
+        nn.quantize(dataset);
+        bench("NeuralNetwork::test float32", params, dataset.size(), [&]() {
+            sink = nn.test(dataset, FLOAT32);
+        });
+        bench("NeuralNetwork::test int8", params, dataset.size(), [&]() {
+            sink = nn.test(dataset, INT8);
+        });
+    }
+
+    // the iris and diabetes topologies specialized at compile time
+    {
+        Dataset iris = get_dataset("datasets/iris.csv", CsvSchema());
+        NeuralNetwork dynamic({4, 16, 3});
+        StaticNetwork<4, 16, 3> nn(dynamic);
+        bench("StaticNetwork::learn", "datasets/iris.csv 4-16-3", iris.size(), [&]() {
+            nn.learn(iris, 0.01);
+        });
+        bench("StaticNetwork::test", "datasets/iris.csv 4-16-3", iris.size(), [&]() {
+            sink = nn.test(iris);
+        });
+
+        Dataset diabetes = get_dataset("datasets/diabetes.csv", CsvSchema());
+        StaticNetwork<8, 16, 2> small(NeuralNetwork({8, 16, 2}));
+        bench("StaticNetwork::learn", "datasets/diabetes.csv 8-16-2", diabetes.size(), [&]() {
+            small.learn(diabetes, 0.01);
+        });
+        bench("StaticNetwork::test", "datasets/diabetes.csv 8-16-2", diabetes.size(), [&]() {
+            sink = small.test(diabetes);
+        });
+    }
+
+    // JSON report
+    printf("[\n");
+    for (size_t i=0; i<results.size(); i++) {
+        const BenchResult& r = results[i];
+        printf("  {\"name\": \"%s\", \"params\": \"%s\", \"ops\": %ld, \"ns_per_op\": %.1f, "
+            "\"samples_per_sec\": %.1f, \"allocs_per_op\": %.2f}%s\n",
+            r.name.c_str(), r.params.c_str(), r.ops, r.nsPerOp, r.samplesPerSec, r.allocsPerOp,
+            i+1 < results.size() ? "," : "");
+    }
+    printf("]\n");
+    return 0;
+}
@@ -0,0 +1,239 @@
+#include "checkpoint.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+// Round an offset up to the block alignment
+static size_t align(size_t offset) {
+    return (offset + CHECKPOINT_ALIGNMENT-1) / CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT;
+}
+
+// Offsets of the columns and values of a CSR block starting at offset, returns the end of the block
+static size_t csr_layout(size_t offset, size_t rows, size_t entries, size_t& columnsOffset, size_t& valuesOffset) {
+    columnsOffset = align(offset + (rows+1)*sizeof(uint64_t));
+    valuesOffset = align(columnsOffset + entries*sizeof(uint32_t));
+    return align(valuesOffset + entries*sizeof(double));
+}
+
+// Offset of every block for the given layer sizes, returns the file size
+size_t checkpoint_layout(const std::vector<size_t>& layerSizes, const std::vector<uint64_t>& storedWeights,
+    size_t& normalizationOffset, std::vector<size_t>& weightOffsets, std::vector<size_t>& biasOffsets, uint32_t version) {
+    size_t numTables = version >= 4 ? 3 : version >= 2 ? 2 : 1; // layer sizes, activations, then stored weight counts
+    size_t offset = align(sizeof(CheckpointHeader) + numTables*layerSizes.size()*sizeof(uint64_t) +
+        (version >= 3 ? sizeof(uint64_t) : 0));
+    normalizationOffset = 0;
+    if (version >= 3) {
+        normalizationOffset = offset;
+        offset = align(offset + 2*layerSizes.front()*sizeof(double));
+    }
+    weightOffsets.clear();
+    biasOffsets.clear();
+    for (size_t l=0; l<layerSizes.size(); l++) {
+        size_t numInputs = l ? layerSizes[l-1] : 0;
+        weightOffsets.push_back(offset);
+        if (l < storedWeights.size() && storedWeights[l] != CHECKPOINT_DENSE) {
+            size_t columnsOffset, valuesOffset;
+            offset = csr_layout(offset, layerSizes[l], storedWeights[l], columnsOffset, valuesOffset);
+        }
+        else
+            offset = align(offset + layerSizes[l]*numInputs*sizeof(double));
+        biasOffsets.push_back(offset);
+        offset = align(offset + layerSizes[l]*sizeof(double));
+    }
+    return offset;
+}
+
+// Write the network to a checkpoint, replacing the file atomically
+void save_checkpoint(const NeuralNetwork& nn, const std::string& filename) {
+    std::vector<size_t> layerSizes;
+    for (auto layer : nn.layers) layerSizes.push_back(layer->nodes.size());
+
+    // pruned layers go in as CSR when their nonzero weights take less room that way
+    std::vector<uint64_t> storedWeights;
+    for (auto layer : nn.layers) {
+        size_t nonzeros = layer->weights.size() - std::count(layer->weights.begin(), layer->weights.end(), 0.0);
+        size_t columnsOffset, valuesOffset;
+        bool csr = csr_layout(0, layer->nodes.size(), nonzeros, columnsOffset, valuesOffset) <
+            align(layer->weights.size()*sizeof(double));
+        storedWeights.push_back(csr ? nonzeros : CHECKPOINT_DENSE);
+    }
+    size_t normalizationOffset;
+    std::vector<size_t> weightOffsets, biasOffsets;
+    std::vector<char> buffer(checkpoint_layout(layerSizes, storedWeights, normalizationOffset, weightOffsets, biasOffsets), 0);
+
+    // header, layer sizes, activations, normalization type and stored weight counts
+    CheckpointHeader header;
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.dtype = CHECKPOINT_FLOAT64;
+    header.numLayers = layerSizes.size();
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    char* table = buffer.data() + sizeof(header);
+    for (size_t l=0; l<layerSizes.size(); l++) {
+        uint64_t size = layerSizes[l];
+        uint64_t activation = nn.layers[l]->activation;
+        std::memcpy(table + l*sizeof(uint64_t), &size, sizeof(size));
+        std::memcpy(table + (layerSizes.size()+l)*sizeof(uint64_t), &activation, sizeof(activation));
+    }
+    const Normalization& normalization = nn.normalization;
+    uint64_t normalizationType = normalization.empty() ? NO_NORMALIZATION : normalization.type;
+    std::memcpy(table + 2*layerSizes.size()*sizeof(uint64_t), &normalizationType, sizeof(normalizationType));
+    std::memcpy(table + (2*layerSizes.size()+1)*sizeof(uint64_t), storedWeights.data(), storedWeights.size()*sizeof(uint64_t));
+
+    // normalization block, an identity transform when there is none
+    double* shift = reinterpret_cast<double*>(buffer.data() + normalizationOffset);
+    double* scale = shift + layerSizes.front();
+    for (size_t i=0; i<layerSizes.front(); i++) {
+        bool stored = !normalization.empty() && i < normalization.size();
+        shift[i] = stored ? normalization.shift[i] : 0.0;
+        scale[i] = stored ? normalization.scale[i] : 1.0;
+    }
+
+    // weight and bias blocks
+    for (size_t l=0; l<nn.layers.size(); l++) {
+        const Layer* layer = nn.layers[l];
+        std::memcpy(buffer.data() + biasOffsets[l], layer->biases.data(), layer->biases.size()*sizeof(double));
+        if (storedWeights[l] == CHECKPOINT_DENSE) {
+            std::memcpy(buffer.data() + weightOffsets[l], layer->weights.data(), layer->weights.size()*sizeof(double));
+            continue;
+        }
+        size_t columnsOffset, valuesOffset;
+        csr_layout(weightOffsets[l], layer->nodes.size(), storedWeights[l], columnsOffset, valuesOffset);
+        uint64_t* rowStart = reinterpret_cast<uint64_t*>(buffer.data() + weightOffsets[l]);
+        uint32_t* columns = reinterpret_cast<uint32_t*>(buffer.data() + columnsOffset);
+        double* values = reinterpret_cast<double*>(buffer.data() + valuesOffset);
+        size_t entry = 0;
+        for (size_t n=0; n<layer->nodes.size(); n++) {
+            rowStart[n] = entry;
+            for (size_t i=0; i<layer->numInputs; i++) {
+                double weight = layer->weights[n*layer->numInputs + i];
+                if (weight == 0.0) continue;
+                columns[entry] = i;
+                values[entry++] = weight;
+            }
+        }
+        rowStart[layer->nodes.size()] = entry;
+    }
+
+    // write beside the target and rename, so readers never see half a file
+    std::string temporary = filename + ".tmp";
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    file.write(buffer.data(), buffer.size());
+    file.close();
+    if (!file || std::rename(temporary.c_str(), filename.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("failed to write checkpoint " + filename);
+    }
+}
+
+// Read a network from a checkpoint, throws std::runtime_error on a bad file
+NeuralNetwork* load_checkpoint(const std::string& filename, bool mapped) {
+    auto mapping = std::make_shared<MappedFile>(filename, true);
+    auto fail = [&filename](const std::string& reason) {
+        return std::runtime_error(filename + ": " + reason);
+    };
+
+    // check the header before trusting any sizes
+    CheckpointHeader header;
+    if (mapping->size < sizeof(header)) throw fail("too small to be a checkpoint");
+    std::memcpy(&header, mapping->data, sizeof(header));
+    if (std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0) throw fail("not a checkpoint");
+    if (header.version == 0 || header.version > CHECKPOINT_VERSION)
+        throw fail("unsupported version " + std::to_string(header.version));
+    if (header.dtype != CHECKPOINT_FLOAT64) throw fail("unsupported dtype " + std::to_string(header.dtype));
+    size_t numTables = header.version >= 4 ? 3 : header.version >= 2 ? 2 : 1;
+    if (header.numLayers == 0 || header.numLayers > mapping->size ||
+        sizeof(header) + (numTables*header.numLayers + (header.version >= 3))*sizeof(uint64_t) > mapping->size)
+        throw fail("bad layer count");
+
+    const char* table = mapping->data + sizeof(header);
+    std::vector<size_t> layerSizes(header.numLayers);
+    std::vector<Activation> activations(header.numLayers, SIGMOID);
+    for (size_t l=0; l<layerSizes.size(); l++) {
+        uint64_t size;
+        std::memcpy(&size, table + l*sizeof(uint64_t), sizeof(size));
+        if (size == 0 || size > mapping->size) throw fail("bad layer size");
+        layerSizes[l] = size;
+
+        if (numTables < 2) continue;
+        uint64_t activation;
+        std::memcpy(&activation, table + (layerSizes.size()+l)*sizeof(uint64_t), sizeof(activation));
+        if (activation > SOFTMAX) throw fail("unknown activation " + std::to_string(activation));
+        activations[l] = (Activation)activation;
+    }
+    uint64_t normalizationType = NO_NORMALIZATION;
+    if (header.version >= 3) {
+        std::memcpy(&normalizationType, table + 2*layerSizes.size()*sizeof(uint64_t), sizeof(normalizationType));
+        if (normalizationType > MINMAX) throw fail("unknown normalization " + std::to_string(normalizationType));
+    }
+    std::vector<uint64_t> storedWeights(layerSizes.size(), CHECKPOINT_DENSE);
+    if (header.version >= 4) {
+        std::memcpy(storedWeights.data(), table + (2*layerSizes.size()+1)*sizeof(uint64_t), storedWeights.size()*sizeof(uint64_t));
+        for (size_t l=0; l<layerSizes.size(); l++)
+            if (storedWeights[l] != CHECKPOINT_DENSE && storedWeights[l] > layerSizes[l]*(l ? layerSizes[l-1] : 0))
+                throw fail("bad stored weight count");
+    }
+    size_t normalizationOffset;
+    std::vector<size_t> weightOffsets, biasOffsets;
+    if (checkpoint_layout(layerSizes, storedWeights, normalizationOffset, weightOffsets, biasOffsets, header.version) > mapping->size)
+        throw fail("truncated");
+
+    // dense layers view the copy-on-write mapping, so training a loaded network never touches the file
+    // CSR layers are expanded into weights of their own, training and the other precisions need them dense
+    NeuralNetwork* nn = new NeuralNetwork();
+    for (size_t l=0; l<layerSizes.size(); l++) {
+        size_t numInputs = l ? layerSizes[l-1] : 0;
+        double* biases = reinterpret_cast<double*>(mapping->data + biasOffsets[l]);
+        if (storedWeights[l] == CHECKPOINT_DENSE) {
+            nn->layers.push_back(new Layer(layerSizes[l], numInputs,
+                reinterpret_cast<double*>(mapping->data + weightOffsets[l]), biases, activations[l]));
+            continue;
+        }
+        Layer* layer = new Layer(layerSizes[l], numInputs, activations[l]);
+        nn->layers.push_back(layer);
+        std::copy(biases, biases + layerSizes[l], layer->biases.data());
+        std::fill(layer->weights.begin(), layer->weights.end(), 0.0);
+
+        size_t columnsOffset, valuesOffset;
+        csr_layout(weightOffsets[l], layerSizes[l], storedWeights[l], columnsOffset, valuesOffset);
+        const char* rowStart = mapping->data + weightOffsets[l];
+        const uint32_t* columns = reinterpret_cast<const uint32_t*>(mapping->data + columnsOffset);
+        const double* values = reinterpret_cast<const double*>(mapping->data + valuesOffset);
+        uint64_t begin = 0;
+        for (size_t n=0; n<layerSizes[l]; n++) {
+            uint64_t start, end;
+            std::memcpy(&start, rowStart + n*sizeof(uint64_t), sizeof(start));
+            std::memcpy(&end, rowStart + (n+1)*sizeof(uint64_t), sizeof(end));
+            if (start != begin || end < start || end > storedWeights[l] || (n+1 == layerSizes[l] && end != storedWeights[l])) {
+                delete nn;
+                throw fail("bad sparse rows in layer " + std::to_string(l));
+            }
+            for (uint64_t e=start; e<end; e++) {
+                if (columns[e] >= numInputs) {
+                    delete nn;
+                    throw fail("bad sparse column in layer " + std::to_string(l));
+                }
+                layer->weights[n*numInputs + columns[e]] = values[e];
+            }
+            begin = end;
+        }
+    }
+
+    // the normalization is small, so it is always copied
+    if (normalizationType != NO_NORMALIZATION) {
+        const double* shift = reinterpret_cast<const double*>(mapping->data + normalizationOffset);
+        nn->normalization.type = (NormalizationType)normalizationType;
+        nn->normalization.shift.assign(shift, shift + layerSizes.front());
+        nn->normalization.scale.assign(shift + layerSizes.front(), shift + 2*layerSizes.front());
+    }
+
+    if (mapped)
+        nn->mapping = mapping;
+    else
+        for (size_t l=0; l<layerSizes.size(); l++)
+            if (storedWeights[l] == CHECKPOINT_DENSE) nn->layers[l]->own();
+    nn->sparsify(); // the CSR layers, and layers that were too dense for it with their pruned weights saved as zeros
+    return nn;
+}
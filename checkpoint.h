@@ -0,0 +1,48 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "neural_network.h"
+
+/*
+Binary checkpoint layout, little-endian, every block starts on a 64 byte boundary
+  header - CheckpointHeader followed by numLayers uint64 layer sizes,
+           then numLayers uint64 activations (version 2 onwards, version 1 is all sigmoid)
+           then a uint64 normalization type (version 3 onwards)
+           then numLayers uint64 stored weight counts, CHECKPOINT_DENSE for dense layers (version 4 onwards)
+  normalization - a shift then a scale for every input (version 3 onwards, unused when the type is none)
+  layers - for each layer its row-major weights, then its biases
+           pruned layers whose nonzero weights take less room as CSR store rows+1 uint64 row starts,
+           then uint32 columns, then double values in place of the weights (version 4 onwards)
+*/
+static const char CHECKPOINT_MAGIC[8] = {'N', 'N', 'S', 'B', 'O', 'X', 'M', '\0'};
+static const uint32_t CHECKPOINT_VERSION = 4;
+static const uint32_t CHECKPOINT_FLOAT64 = 0;
+static const size_t CHECKPOINT_ALIGNMENT = 64;
+static const uint64_t CHECKPOINT_DENSE = UINT64_MAX;
+
+struct CheckpointHeader {
+    public:
+        char magic[8];
+        uint32_t version;
+        uint32_t dtype;
+        uint64_t numLayers;
+};
+
+// Write the network to a checkpoint, replacing the file atomically
+void save_checkpoint(const NeuralNetwork& nn, const std::string& filename);
+
+// Read a network from a checkpoint, throws std::runtime_error on a bad file
+// mapped networks view the file directly so processes share one copy of the weights
+NeuralNetwork* load_checkpoint(const std::string& filename, bool mapped=true);
+
+// Offset of the normalization block and every weight and bias block for the given layer sizes
+// and stored weight counts (empty when every layer is dense), the weight offset of a CSR layer is its row starts
+// returns the file size, normalizationOffset is 0 for versions without one
+size_t checkpoint_layout(const std::vector<size_t>& layerSizes, const std::vector<uint64_t>& storedWeights,
+    size_t& normalizationOffset,
+    std::vector<size_t>& weightOffsets, std::vector<size_t>& biasOffsets, uint32_t version=CHECKPOINT_VERSION);
+
+#endif
@@ -5,12 +5,25 @@
 This is information about the dataset
   FILENAME - name of the file to be read in
   FEATURES - name of the features
-  CLASSES - possible output values
+  CLASSES - possible output values, leave empty ({}) to read them from the file
+             numeric labels that don't match a name are used as the class index
 */
 #define FILENAME "datasets/iris.csv"
 #define FEATURES {"Sepal-length", "Sepal-width", "Petal-length", "Petal-width"}
 #define CLASSES {"Iris-setosa", "Iris-versicolor", "Iris-virginica"}
 
+/* other bundled datasets
+#define FILENAME "datasets/wine.csv"
+#define FEATURES {"Fixed-acidity", "Volatile-acidity", "Citric-acid", "Residual-sugar", "Chlorides", \
+    "Free-sulfur-dioxide", "Total-sulfur-dioxide", "Density", "pH", "Sulphates", "Alcohol"}
+#define CLASSES {}
+
+#define FILENAME "datasets/diabetes.csv"
+#define FEATURES {"Pregnancies", "Glucose", "Blood-pressure", "Skin-thickness", "Insulin", "BMI", \
+    "Diabetes-pedigree", "Age"}
+#define CLASSES {"Negative", "Positive"}
+*/
+
 /*
 Default Layer Sizes for the Neural Network
   make sure first layer (input) has the same size as the feature set
@@ -18,11 +31,126 @@ Default Layer Sizes for the Neural Network
 */
 #define NEURAL_NETWORK_LAYERS {features.size(), 5, classes.size()}
 
+/*
+Activation of the layers, one of SIGMOID, RELU, TANH or SOFTMAX
+  HIDDEN_ACTIVATION - every layer between the input and the output
+  OUTPUT_ACTIVATION - the output layer
+  the resize command can also pick them per layer (eg. 4 8:relu 3:softmax)
+  a SOFTMAX output trains on the cross-entropy loss, the others on squared error
+*/
+#define HIDDEN_ACTIVATION SIGMOID
+#define OUTPUT_ACTIVATION SIGMOID
+
+/*
+Layer sizes compiled into a specialized network for serving
+  'main --predict' uses it for checkpoints with exactly these sizes
+  eg. 11, 5, 7 for wine and 8, 5, 2 for diabetes
+*/
+#define STATIC_NETWORK_LAYERS 4, 5, 3
+
+/*
+Pruned layers, see the prune command
+  SPARSE_DENSITY - share of weights left below which one instance at a time goes through the sparse kernel
+  SPARSE_BATCH_DENSITY - the same for batches, where every weight is reused across the batch
+  both are the crossovers of the sparse and dense rows of ./bench
+*/
+#define SPARSE_DENSITY 0.25
+#define SPARSE_BATCH_DENSITY 0.7
+
+
+/*
+Used for reading in CSV files. Probably won't need to edit this.
+  DELIMITER - character between columns, 0 detects it from the first line
+  LABEL_COLUMN - column holding the class, negative counts from the last column
+*/
+#define DELIMITER 0
+#define LABEL_COLUMN -1
+
+/*
+Streaming datasets too large for memory
+  STREAM_CHUNK_BYTES - size of each block read from the file
+  STREAM_SHUFFLE_BUFFER - instances held for shuffling while streaming
+  STREAM_BATCH_SIZE - instances per learning step
+  TEST_FRACTION - share of the rows used for testing
+*/
+#define STREAM_CHUNK_BYTES (16 << 20)
+#define STREAM_SHUFFLE_BUFFER 65536
+#define STREAM_BATCH_SIZE 256
+#define TEST_FRACTION 0.4
+
+// Keep a parsed binary copy of the dataset beside the CSV file for faster loading
+#define DATASET_CACHE true
+
+/*
+Rescaling applied to the features as the dataset loads, trained networks save it with their weights
+  NO_NORMALIZATION - raw features
+  ZSCORE - zero mean and unit variance per feature
+  MINMAX - every feature mapped to [0, 1]
+*/
+#define NORMALIZATION ZSCORE
+
+/*
+Optimizer used for training
+  OPTIMIZER - SGD, MOMENTUM, NESTEROV, ADAM or ADAMW
+  MOMENTUM_DECAY - momentum of MOMENTUM and NESTEROV, first moment decay of ADAM and ADAMW
+  ADAM_BETA2 - second moment decay of ADAM and ADAMW
+  WEIGHT_DECAY - decoupled weight decay of ADAMW
+*/
+#define OPTIMIZER ADAM
+#define MOMENTUM_DECAY 0.9
+#define ADAM_BETA2 0.999
+#define WEIGHT_DECAY 0.01
+
+/*
+Learn rate schedule over a training run
+  LR_SCHEDULE - CONSTANT, STEP or COSINE
+  LR_WARMUP - steps spent ramping the rate up from zero first
+  LR_STEP_SIZE, LR_STEP_DECAY - STEP multiplies the rate by the decay every step size steps
+  LR_MIN_FRACTION - COSINE anneals down to this fraction of the learn rate by the last step
+*/
+#define LR_SCHEDULE CONSTANT
+#define LR_WARMUP 0
+#define LR_STEP_SIZE 100
+#define LR_STEP_DECAY 0.5
+#define LR_MIN_FRACTION 0.0
+
+// Number of threads used for training, 0 uses every hardware thread
+#define TRAIN_THREADS 0
+
+/*
+Training telemetry, leave empty to turn off
+  TELEMETRY_FILE - per-epoch timings, CSV when it ends in .csv and JSON lines otherwise
+  TRACE_FILE - Chrome trace events of every training phase (open in chrome://tracing)
+*/
+#define TELEMETRY_FILE ""
+#define TRACE_FILE ""
+
+/*
+Scoring rows with 'main --predict model.bin [rows.csv]'
+  PREDICT_BATCH_SIZE - most rows run through the network at once
+  PREDICT_TIMEOUT - seconds a partial batch waits for more rows before it runs
+*/
+#define PREDICT_BATCH_SIZE 1024
+#define PREDICT_TIMEOUT 0.01
+
+/*
+Evaluation during training
+  ASYNC_EVAL - evaluate snapshots of the weights on a background thread while the next epochs train
+  EVAL_INTERVAL - iterations between evaluations, the last iteration is always evaluated
+  EARLY_STOP_PATIENCE - evaluations without a lower validation loss before training stops and returns
+                        to the best weights, 0 only stops on convergence
+  VALIDATION_FRACTION - share of the training rows held out to measure the validation loss on,
+                        the test rows are only used for reporting
+*/
+#define ASYNC_EVAL true
+#define EVAL_INTERVAL 1
+#define EARLY_STOP_PATIENCE 50
+#define VALIDATION_FRACTION 0.2
 
-// Used for reading in CSV files. Probably won't need to edit this.
-#define DELIMITER ','
+// Iterations between checkpoints when training with a checkpoint file
+#define CHECKPOINT_INTERVAL 10
 
-// Randomness
+// Key of every random stream (weight init, splits, sampling and shuffling), see rng.h
 #define RANDOM_SEED 87123401
 
 
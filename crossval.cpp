@@ -0,0 +1,59 @@
+#include "crossval.h"
+#include "sampling.h"
+#include "thread_pool.h"
+#include <chrono>
+#include <cmath>
+#include <memory>
+
+// Train and test every fold on the pool
+std::vector<FoldResult> cross_validate(const NeuralNetwork& model, const Dataset& dataset,
+    const std::vector<size_t>& rows, const CrossValidation& settings) {
+    RandomStream random = settings.random;
+    std::vector<std::vector<size_t>> folds = stratified_folds(dataset, rows, settings.folds, random);
+
+    // rows and starting weights of every fold are settled up front, so the results
+    // don't depend on which thread picks up which fold
+    std::vector<std::vector<size_t>> train_rows(folds.size()), validation_rows(folds.size());
+    std::vector<std::unique_ptr<NeuralNetwork>> networks(folds.size());
+    for (size_t f=0; f<folds.size(); f++) {
+        std::vector<size_t> rows;
+        for (size_t other=0; other<folds.size(); other++)
+            if (other != f) rows.insert(rows.end(), folds[other].begin(), folds[other].end());
+        RandomStream fold_random = settings.random.child(f);
+        if (settings.resampleRatio > 0)
+            rows = resample_rows(dataset, rows, settings.resampleRatio, fold_random);
+
+        // the held out fold is only tested, training picks its weights on a slice of its own rows
+        validation_split(dataset, rows, settings.validationFraction, fold_random, train_rows[f], validation_rows[f]);
+
+        networks[f].reset(model.clone());
+        networks[f]->randomize(f); // fold f is weight init run f, whatever thread trains it
+        networks[f]->quiet = true;
+    }
+
+    // a fold's own learning steps run inline on the thread that took it
+    std::vector<FoldResult> results(folds.size());
+    thread_pool().parallel_for(folds.size(), [&](size_t f) {
+        auto start = std::chrono::steady_clock::now();
+        DatasetView trainset(dataset, train_rows[f]), validation(dataset, validation_rows[f]), testset(dataset, folds[f]);
+        networks[f]->train(trainset, validation, settings.maxIteration, settings.learnRate);
+
+        FoldResult& result = results[f];
+        result.trainSize = trainset.size();
+        result.testSize = testset.size();
+        result.accuracy = networks[f]->test(testset);
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    });
+    return results;
+}
+
+// Mean and standard deviation of the accuracies
+void accuracy_stats(const std::vector<FoldResult>& results, double& mean, double& stddev) {
+    mean = 0.0;
+    for (auto& result : results) mean += result.accuracy;
+    mean /= results.size();
+
+    double variance = 0.0;
+    for (auto& result : results) variance += (result.accuracy - mean) * (result.accuracy - mean);
+    stddev = std::sqrt(variance / results.size());
+}
@@ -0,0 +1,38 @@
+#ifndef CROSSVAL_H
+#define CROSSVAL_H
+
+#include <vector>
+#include <cstddef>
+#include "neural_network.h"
+#include "dataset.h"
+#include "rng.h"
+
+// Outcome of training on all folds but one and testing on that one
+struct FoldResult {
+    public:
+        size_t trainSize;
+        size_t testSize;
+        double accuracy;
+        double seconds; // wall time to train and test the fold
+};
+
+// Settings of a cross-validation run
+struct CrossValidation {
+    public:
+        size_t folds = 5;
+        size_t maxIteration = 100;
+        double learnRate = 1.0;
+        double resampleRatio = 0.0; // above 0 balances the training rows of every fold, test rows are left alone
+        double validationFraction = 0.2; // of the training rows, held out to pick each fold's weights
+        RandomStream random; // deals the folds, fold f resamples and holds out validation rows with its child f
+};
+
+// Stratified k-fold cross-validation of a freshly randomized copy of model's layers and optimizer
+// the folds train concurrently, one per thread of the pool
+std::vector<FoldResult> cross_validate(const NeuralNetwork& model, const Dataset& dataset,
+    const std::vector<size_t>& rows, const CrossValidation& settings);
+
+// Mean and population standard deviation of the fold accuracies
+void accuracy_stats(const std::vector<FoldResult>& results, double& mean, double& stddev);
+
+#endif
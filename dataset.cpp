@@ -0,0 +1,474 @@
+#include "dataset.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <sys/stat.h>
+
+// Files are parsed in parallel in chunks of at least this many bytes
+static const size_t MIN_PARSE_CHUNK = 1 << 20;
+
+// Add an instance to the end of the dataset
+void Dataset::append(const double* instanceFeatures, int label) {
+    features.data.insert(features.data.end(), instanceFeatures, instanceFeatures + features.cols);
+    features.rows++;
+    labels.push_back(label);
+}
+// Copy of the given rows
+Dataset Dataset::subset(const std::vector<size_t>& rows) const {
+    Dataset result;
+    result.classes = classes;
+    result.normalization = normalization;
+    result.features.resize(rows.size(), features.cols);
+    result.labels.resize(rows.size());
+    for (size_t i=0; i<rows.size(); i++) {
+        std::copy(features[rows[i]], features[rows[i]] + features.cols, result.features[i]);
+        result.labels[i] = labels[rows[i]];
+    }
+    return result;
+}
+
+// Copy the features of instances [begin, end) into a matrix, one per row
+void DatasetView::gather(size_t begin, size_t end, Matrix& batch) const {
+    batch.resize(end - begin, numFeatures());
+    for (size_t i=begin; i<end; i++) {
+        const double* source = features(i);
+        std::copy(source, source + batch.cols, batch[i - begin]);
+    }
+}
+
+// Build an error message pointing at the bad input
+static std::runtime_error csv_error(size_t line, size_t column, const std::string& message) {
+    return std::runtime_error("line " + std::to_string(line) + ", column " + std::to_string(column) + ": " + message);
+}
+// Trim spaces and carriage returns around a field
+static void trim(const char*& begin, const char*& end) {
+    while (begin < end && (*begin == ' ' || *begin == '\t' || *begin == '\r')) begin++;
+    while (end > begin && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) end--;
+}
+
+// Pick the most frequent of the common delimiters in the first line
+char detect_delimiter(const char* begin, const char* end) {
+    const char* line_end = std::find(begin, end, '\n');
+    char best = ',';
+    long best_count = 0;
+    for (char candidate : {',', ';', '\t', '|'}) {
+        long count = std::count(begin, line_end, candidate);
+        if (count > best_count) {best = candidate; best_count = count;}
+    }
+    return best;
+}
+
+// Turn a label field into a class index
+static int parse_label(const char* begin, const char* end, const CsvSchema& schema, Dataset& dataset,
+    size_t line, size_t column) {
+    std::string_view token(begin, end-begin);
+
+    // discover the classes in order of first appearance
+    if (schema.classes.empty()) {
+        auto it = std::find(dataset.classes.begin(), dataset.classes.end(), token);
+        if (it != dataset.classes.end()) return std::distance(dataset.classes.begin(), it);
+        dataset.classes.push_back(std::string(token));
+        return dataset.classes.size()-1;
+    }
+
+    // named classes, or a numeric label that indexes them directly
+    auto it = std::find(schema.classes.begin(), schema.classes.end(), token);
+    if (it != schema.classes.end()) return std::distance(schema.classes.begin(), it);
+    int index;
+    auto result = std::from_chars(begin, end, index);
+    if (result.ec == std::errc() && result.ptr == end && index >= 0 && (size_t)index < schema.classes.size())
+        return index;
+    throw csv_error(line, column, "unknown label '" + std::string(token) + "'");
+}
+
+// Parse CSV text into dataset, lines are numbered from firstLine in errors
+void parse_csv(const char* begin, const char* end, char delimiter, const CsvSchema& schema,
+    Dataset& dataset, size_t firstLine, FeatureStats* stats) {
+    std::vector<double> row;
+    size_t line = firstLine;
+
+    for (const char* cursor = begin; cursor < end; line++) {
+        const char* line_end = static_cast<const char*>(std::memchr(cursor, '\n', end-cursor));
+        if (!line_end) line_end = end;
+
+        // skip blank lines
+        const char* first = cursor, *last = line_end;
+        trim(first, last);
+        if (first == last) {cursor = line_end + (line_end < end); continue;}
+
+        // split the line into fields, numbers go straight into the row
+        row.clear();
+        const char* label_begin = nullptr, *label_end = nullptr;
+        size_t numColumns = std::count(cursor, line_end, delimiter) + 1;
+        size_t label_column = schema.labelColumn < 0 ? numColumns + schema.labelColumn : schema.labelColumn;
+        if (label_column >= numColumns)
+            throw csv_error(line, numColumns, "missing label column");
+
+        const char* field = cursor;
+        for (size_t column=0; column<numColumns; column++) {
+            const char* field_end = std::find(field, line_end, delimiter);
+            const char* value = field, *value_end = field_end;
+            trim(value, value_end);
+
+            if (column == label_column) {
+                label_begin = value; label_end = value_end;
+            } else {
+                double number;
+                if (value < value_end && *value == '+') value++; // from_chars rejects a leading '+'
+                auto result = std::from_chars(value, value_end, number);
+                if (result.ec != std::errc() || result.ptr != value_end || value == value_end)
+                    throw csv_error(line, column+1, "expected a number, got '" + std::string(value, value_end) + "'");
+                row.push_back(number);
+            }
+            field = field_end+1;
+        }
+
+        // every row needs the same number of features as the first
+        if (dataset.features.cols == 0 && dataset.size() == 0)
+            dataset.features.cols = row.size();
+        else if (row.size() != dataset.features.cols)
+            throw csv_error(line, numColumns, "expected " + std::to_string(dataset.features.cols+1) +
+                " columns, got " + std::to_string(numColumns));
+
+        dataset.append(row.data(), parse_label(label_begin, label_end, schema, dataset, line, label_column+1));
+        if (stats) stats->add(row.data(), row.size());
+        cursor = line_end + (line_end < end);
+    }
+}
+
+// Parse the features of one CSV line, with or without its label column
+bool parse_features(const char* begin, const char* end, char delimiter, int labelColumn,
+    size_t numFeatures, std::vector<double>& row, size_t line) {
+    const char* first = begin, *last = end;
+    trim(first, last);
+    if (first == last) return false;
+
+    size_t numColumns = std::count(begin, end, delimiter) + 1;
+    size_t label_column = numColumns; // no label column
+    if (numColumns == numFeatures+1)
+        label_column = labelColumn < 0 ? numColumns + labelColumn : labelColumn;
+    else if (numColumns != numFeatures)
+        throw csv_error(line, numColumns, "expected " + std::to_string(numFeatures) + " features, got " +
+            std::to_string(numColumns) + " columns");
+
+    row.clear();
+    const char* field = begin;
+    for (size_t column=0; column<numColumns; column++) {
+        const char* field_end = std::find(field, end, delimiter);
+        const char* value = field, *value_end = field_end;
+        trim(value, value_end);
+        field = field_end+1;
+        if (column == label_column) continue;
+
+        double number;
+        if (value < value_end && *value == '+') value++; // from_chars rejects a leading '+'
+        auto result = std::from_chars(value, value_end, number);
+        if (result.ec != std::errc() || result.ptr != value_end || value == value_end)
+            throw csv_error(line, column+1, "expected a number, got '" + std::string(value, value_end) + "'");
+        row.push_back(number);
+    }
+    return true;
+}
+
+// Sort discovered classes numerically when every one of them is a number
+void sort_numeric_classes(Dataset& dataset) {
+    std::vector<std::pair<double, size_t>> values;
+    for (size_t i=0; i<dataset.classes.size(); i++) {
+        const std::string& name = dataset.classes[i];
+        double value;
+        auto result = std::from_chars(name.data(), name.data()+name.size(), value);
+        if (result.ec != std::errc() || result.ptr != name.data()+name.size()) return;
+        values.push_back({value, i});
+    }
+    std::sort(values.begin(), values.end());
+
+    std::vector<int> remap(values.size());
+    std::vector<std::string> sorted;
+    for (size_t i=0; i<values.size(); i++) {
+        remap[values[i].second] = i;
+        sorted.push_back(dataset.classes[values[i].second]);
+    }
+    for (auto& label : dataset.labels) label = remap[label];
+    dataset.classes = sorted;
+}
+
+// Parse a mapped CSV file, throws std::runtime_error with the line and column of bad input
+static Dataset parse_dataset(const std::string& filename, const MappedFile& file, const CsvSchema& schema) {
+    char delimiter = schema.delimiter ? schema.delimiter : detect_delimiter(file.begin(), file.end());
+
+    // split the file into chunks on line boundaries
+    size_t numChunks = std::max((size_t)1, std::min(thread_pool().size()*4, file.size / MIN_PARSE_CHUNK));
+    std::vector<const char*> bounds = {file.begin()};
+    for (size_t c=1; c<numChunks; c++) {
+        const char* guess = std::max(bounds.back(), file.begin() + file.size*c/numChunks);
+        const char* newline = std::find(guess, file.end(), '\n');
+        bounds.push_back(newline == file.end() ? newline : newline+1);
+    }
+    bounds.push_back(file.end());
+
+    // count lines first so errors report where they are in the whole file
+    std::vector<size_t> firstLines(numChunks+1, 1);
+    thread_pool().parallel_for(numChunks, [&](size_t c) {
+        firstLines[c+1] = std::count(bounds[c], bounds[c+1], '\n');
+    });
+    for (size_t c=1; c<=numChunks; c++) firstLines[c] += firstLines[c-1];
+
+    // parse every chunk into its own dataset, with the statistics for normalizing gathered on the way
+    std::vector<Dataset> chunks(numChunks);
+    std::vector<FeatureStats> chunkStats(numChunks);
+    bool normalize = schema.normalization != NO_NORMALIZATION;
+    thread_pool().parallel_for(numChunks, [&](size_t c) {
+        size_t numLines = firstLines[c+1]-firstLines[c] + 1;
+        chunks[c].labels.reserve(numLines);
+        chunks[c].features.data.reserve(numLines * std::count(file.begin(), std::find(file.begin(), file.end(), '\n'), delimiter));
+        try {
+            parse_csv(bounds[c], bounds[c+1], delimiter, schema, chunks[c], firstLines[c],
+                normalize ? &chunkStats[c] : nullptr);
+        } catch (const std::runtime_error& e) {
+            throw std::runtime_error(filename + ": " + e.what());
+        }
+    });
+
+    // join the chunks in order, merging discovered classes
+    Dataset dataset;
+    dataset.classes = schema.classes;
+    size_t rows = 0;
+    for (auto& chunk : chunks) {
+        if (chunk.size() == 0) continue;
+        if (rows > 0 && chunk.features.cols != dataset.features.cols)
+            throw std::runtime_error(filename + ": line " + std::to_string(firstLines[&chunk-&chunks[0]]) +
+                ": column count differs from the first row");
+        dataset.features.cols = chunk.features.cols;
+        rows += chunk.size();
+    }
+    dataset.features.resize(rows, dataset.features.cols);
+    dataset.labels.reserve(rows);
+
+    // chunk statistics merge exactly, in file order
+    FeatureStats stats;
+    for (auto& chunk_stats : chunkStats) stats.merge(chunk_stats);
+    dataset.normalization = stats.normalization(schema.normalization);
+
+    size_t row = 0;
+    for (auto& chunk : chunks) {
+        std::vector<int> remap(chunk.classes.size());
+        for (size_t i=0; i<chunk.classes.size(); i++) {
+            auto it = std::find(dataset.classes.begin(), dataset.classes.end(), chunk.classes[i]);
+            if (it == dataset.classes.end()) it = dataset.classes.insert(it, chunk.classes[i]);
+            remap[i] = std::distance(dataset.classes.begin(), it);
+        }
+        // normalized row by row as they are copied into place, while each is still in cache
+        for (size_t r=0; r<chunk.size(); r++) {
+            double* target = dataset.features[row + r];
+            std::copy(chunk.features[r], chunk.features[r] + dataset.features.cols, target);
+            dataset.normalization.apply(target);
+        }
+        for (auto label : chunk.labels)
+            dataset.labels.push_back(schema.classes.empty() ? remap[label] : label);
+        row += chunk.size();
+        chunk = Dataset(); // release the chunk as soon as it is copied
+    }
+
+    if (schema.classes.empty()) sort_numeric_classes(dataset);
+    return dataset;
+}
+
+// Read dataset from a CSV file, throws std::runtime_error with the line and column of bad input
+Dataset get_dataset(const std::string& filename, const CsvSchema& schema) {
+    MappedFile file(filename);
+    return parse_dataset(filename, file, schema);
+}
+
+/*
+Dataset cache layout, little-endian, blocks start on a 64 byte boundary
+  header - DatasetCacheHeader
+  classes - for each class a uint64 length followed by its name
+  normalization - cols shifts then cols scales, only when the header's normalization isn't none
+  features - rows x cols doubles, already normalized
+  labels - rows int32
+*/
+static const char CACHE_MAGIC[8] = {'N', 'N', 'S', 'B', 'O', 'X', 'D', '\0'};
+static const uint32_t CACHE_VERSION = 2;
+static const size_t CACHE_ALIGNMENT = 64;
+
+struct DatasetCacheHeader {
+    public:
+        char magic[8];
+        uint32_t version;
+        uint32_t normalization; // NormalizationType
+        uint64_t sourceSize;
+        uint64_t sourceHash;
+        uint64_t schemaHash;
+        uint64_t rows;
+        uint64_t cols;
+        uint64_t numClasses;
+        uint64_t classesSize; // bytes used by the class names block
+};
+
+// Round an offset up to the block alignment
+static size_t cache_align(size_t offset) {
+    return (offset + CACHE_ALIGNMENT-1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+}
+
+// Fast 64-bit hash of a byte range, eight bytes at a time
+static uint64_t hash_bytes(const char* data, size_t size, uint64_t seed=0x9E3779B97F4A7C15ull) {
+    const uint64_t prime = 0x100000001B3ull;
+    uint64_t hash = seed ^ size;
+    size_t i = 0;
+    for (; i+8<=size; i+=8) {
+        uint64_t word;
+        std::memcpy(&word, data+i, sizeof(word));
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 29;
+    }
+    for (; i<size; i++)
+        hash = (hash ^ (unsigned char)data[i]) * prime;
+    return hash ^ (hash >> 32);
+}
+// Hash of everything in the schema that changes how a file parses
+static uint64_t hash_schema(const CsvSchema& schema) {
+    std::string text = std::string(1, schema.delimiter) + std::to_string(schema.labelColumn) +
+        normalization_name(schema.normalization);
+    for (auto& name : schema.classes) text += '\n' + name;
+    return hash_bytes(text.data(), text.size());
+}
+
+// Try to read a cache that matches the source, returns false when it is missing or stale
+static bool read_dataset_cache(const std::string& cachename, const MappedFile& source, uint64_t sourceHash,
+    uint64_t schemaHash, Dataset& dataset) {
+    std::unique_ptr<MappedFile> cache;
+    try {
+        cache.reset(new MappedFile(cachename));
+    } catch (const std::runtime_error&) {
+        return false;
+    }
+
+    DatasetCacheHeader header;
+    if (cache->size < sizeof(header)) return false;
+    std::memcpy(&header, cache->data, sizeof(header));
+    if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != CACHE_VERSION ||
+        header.sourceSize != source.size || header.sourceHash != sourceHash || header.schemaHash != schemaHash)
+        return false;
+
+    // every size is checked against the file before it is used, a corrupted cache is only a miss
+    if (header.normalization > MINMAX || header.classesSize > cache->size || header.numClasses > header.classesSize ||
+        header.cols > cache->size || header.rows > cache->size ||
+        (header.cols && header.rows > cache->size / (header.cols*sizeof(double))))
+        return false;
+    size_t normalizationOffset = cache_align(sizeof(header) + header.classesSize);
+    size_t normalizationSize = header.normalization != NO_NORMALIZATION ? 2*header.cols*sizeof(double) : 0;
+    size_t featuresOffset = cache_align(normalizationOffset + normalizationSize);
+    size_t labelsOffset = cache_align(featuresOffset + header.rows*header.cols*sizeof(double));
+    if (labelsOffset + header.rows*sizeof(int32_t) > cache->size) return false;
+
+    // class names, each a uint64 length and its bytes, filling the block exactly
+    dataset.classes.clear();
+    const char* cursor = cache->data + sizeof(header);
+    size_t remaining = header.classesSize;
+    for (size_t i=0; i<header.numClasses; i++) {
+        uint64_t length;
+        if (remaining < sizeof(length)) return false;
+        std::memcpy(&length, cursor, sizeof(length));
+        if (length > remaining - sizeof(length)) return false;
+        dataset.classes.push_back(std::string(cursor + sizeof(length), length));
+        cursor += sizeof(length) + length;
+        remaining -= sizeof(length) + length;
+    }
+    if (remaining) return false;
+
+    dataset.normalization = Normalization();
+    if (header.normalization != NO_NORMALIZATION) {
+        const double* block = reinterpret_cast<const double*>(cache->data + normalizationOffset);
+        dataset.normalization.type = (NormalizationType)header.normalization;
+        dataset.normalization.shift.assign(block, block + header.cols);
+        dataset.normalization.scale.assign(block + header.cols, block + 2*header.cols);
+    }
+
+    // features and labels are copied out of the mapping in bulk
+    dataset.features.resize(header.rows, header.cols);
+    std::memcpy(dataset.features.data.data(), cache->data + featuresOffset, header.rows*header.cols*sizeof(double));
+    dataset.labels.resize(header.rows);
+    std::vector<int32_t> labels(header.rows);
+    std::memcpy(labels.data(), cache->data + labelsOffset, header.rows*sizeof(int32_t));
+    std::copy(labels.begin(), labels.end(), dataset.labels.begin());
+    return true;
+}
+// Write the cache, failures only cost the next load a reparse
+static void write_dataset_cache(const std::string& cachename, const MappedFile& source, uint64_t sourceHash,
+    uint64_t schemaHash, const Dataset& dataset) {
+    DatasetCacheHeader header;
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.version = CACHE_VERSION;
+    header.normalization = dataset.normalization.empty() ? NO_NORMALIZATION : dataset.normalization.type;
+    header.sourceSize = source.size;
+    header.sourceHash = sourceHash;
+    header.schemaHash = schemaHash;
+    header.rows = dataset.size();
+    header.cols = dataset.numFeatures();
+    header.numClasses = dataset.classes.size();
+    header.classesSize = 0;
+    for (auto& name : dataset.classes) header.classesSize += sizeof(uint64_t) + name.size();
+
+    size_t normalizationOffset = cache_align(sizeof(header) + header.classesSize);
+    size_t normalizationSize = header.normalization != NO_NORMALIZATION ? 2*header.cols*sizeof(double) : 0;
+    size_t featuresOffset = cache_align(normalizationOffset + normalizationSize);
+    size_t labelsOffset = cache_align(featuresOffset + header.rows*header.cols*sizeof(double));
+    std::vector<char> buffer(labelsOffset + header.rows*sizeof(int32_t), 0);
+
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    char* cursor = buffer.data() + sizeof(header);
+    for (auto& name : dataset.classes) {
+        uint64_t length = name.size();
+        std::memcpy(cursor, &length, sizeof(length));
+        std::memcpy(cursor + sizeof(length), name.data(), length);
+        cursor += sizeof(length) + length;
+    }
+    if (normalizationSize) {
+        std::memcpy(buffer.data() + normalizationOffset, dataset.normalization.shift.data(), header.cols*sizeof(double));
+        std::memcpy(buffer.data() + normalizationOffset + header.cols*sizeof(double),
+            dataset.normalization.scale.data(), header.cols*sizeof(double));
+    }
+    std::memcpy(buffer.data() + featuresOffset, dataset.features.data.data(), header.rows*header.cols*sizeof(double));
+    std::vector<int32_t> labels(dataset.labels.begin(), dataset.labels.end());
+    std::memcpy(buffer.data() + labelsOffset, labels.data(), labels.size()*sizeof(int32_t));
+
+    // write beside the cache and rename, so a reader never maps half a file
+    std::string temporary = cachename + ".tmp";
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    file.write(buffer.data(), buffer.size());
+    file.close();
+    if (!file || std::rename(temporary.c_str(), cachename.c_str()) != 0)
+        std::remove(temporary.c_str());
+}
+
+// Read dataset through a binary sidecar cache next to the CSV file
+// the CSV is mapped and hashed once, a miss parses the same mapping
+Dataset get_dataset_cached(const std::string& filename, const CsvSchema& schema) {
+    std::string cachename = filename + ".cache";
+    uint64_t schemaHash = hash_schema(schema);
+    struct stat before;
+    bool stable = ::stat(filename.c_str(), &before) == 0;
+    MappedFile source(filename);
+    uint64_t sourceHash = hash_bytes(source.data, source.size);
+
+    Dataset dataset;
+    if (read_dataset_cache(cachename, source, sourceHash, schemaHash, dataset))
+        return dataset;
+
+    // stale or missing, parse the text and refresh the cache
+    dataset = parse_dataset(filename, source, schema);
+    struct stat after;
+    stable = stable && ::stat(filename.c_str(), &after) == 0 && after.st_size == before.st_size &&
+        after.st_mtim.tv_sec == before.st_mtim.tv_sec && after.st_mtim.tv_nsec == before.st_mtim.tv_nsec;
+    if (stable) // skip caching a file that changed mid-parse
+        write_dataset_cache(cachename, source, sourceHash, schemaHash, dataset);
+    return dataset;
+}
@@ -0,0 +1,86 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <string>
+#include <vector>
+#include "matrix.h"
+#include "normalization.h"
+
+// Instances with their features stored contiguously, one instance per row
+struct Dataset {
+    public:
+        Matrix features;
+        std::vector<int> labels;
+        std::vector<std::string> classes; // name of each label
+        Normalization normalization; // already applied to the features, new inputs need it too
+
+        size_t size() const {return labels.size();}
+        size_t numFeatures() const {return features.cols;}
+
+        void append(const double* instanceFeatures, int label);
+        Dataset subset(const std::vector<size_t>& rows) const; // copy of the given rows
+};
+
+// Non-owning selection of rows from a dataset, rows may repeat when oversampling
+struct DatasetView {
+    public:
+        const Dataset* data;
+        const size_t* rows; // indices into data, nullptr selects rows [first, first+count) in order
+        size_t count;
+        size_t first;
+
+        DatasetView(const Dataset& dataIn)
+            : data(&dataIn), rows(nullptr), count(dataIn.size()), first(0) {}
+        DatasetView(const Dataset& dataIn, const std::vector<size_t>& rowsIn)
+            : data(&dataIn), rows(rowsIn.data()), count(rowsIn.size()), first(0) {}
+        DatasetView(const Dataset* dataIn, const size_t* rowsIn, size_t countIn, size_t firstIn=0)
+            : data(dataIn), rows(rowsIn), count(countIn), first(firstIn) {}
+
+        size_t size() const {return count;}
+        size_t numFeatures() const {return data->numFeatures();}
+        size_t row(size_t i) const {return rows ? rows[i] : first + i;}
+        const double* features(size_t i) const {return data->features[row(i)];}
+        int label(size_t i) const {return data->labels[row(i)];}
+
+        // view of the instances [begin, end)
+        DatasetView slice(size_t begin, size_t end) const {
+            return rows ? DatasetView(data, rows + begin, end - begin) : DatasetView(data, nullptr, end - begin, first + begin);
+        }
+        // copy the features of instances [begin, end) into a matrix, one per row
+        void gather(size_t begin, size_t end, Matrix& batch) const;
+};
+
+// Layout of a CSV file
+struct CsvSchema {
+    public:
+        char delimiter = 0; // 0 detects it from the first line
+        int labelColumn = -1; // negative counts from the last column
+        std::vector<std::string> classes; // empty discovers the classes from the file
+        NormalizationType normalization = NO_NORMALIZATION; // rescaling applied to the features as they load
+};
+
+// Read dataset from a CSV file, throws std::runtime_error with the line and column of bad input
+Dataset get_dataset(const std::string& filename, const CsvSchema& schema);
+
+// Read dataset through a binary sidecar cache next to the CSV file
+// the cache is rebuilt whenever the CSV's contents or the schema change
+Dataset get_dataset_cached(const std::string& filename, const CsvSchema& schema);
+
+// Parse CSV text into dataset, lines are numbered from firstLine in errors
+// stats, if given, gathers the statistics of every parsed row in the same pass
+// the schema's normalization is left to the caller, who has seen every row
+void parse_csv(const char* begin, const char* end, char delimiter, const CsvSchema& schema,
+    Dataset& dataset, size_t firstLine=1, FeatureStats* stats=nullptr);
+
+// Parse the features of one CSV line into row, skipping labelColumn when the line has one more column
+// returns false for a blank line, throws std::runtime_error like get_dataset on bad input
+bool parse_features(const char* begin, const char* end, char delimiter, int labelColumn,
+    size_t numFeatures, std::vector<double>& row, size_t line);
+
+// Sort discovered classes numerically when every one of them is a number, relabelling to match
+void sort_numeric_classes(Dataset& dataset);
+
+// Pick the most frequent of the common delimiters in the first line
+char detect_delimiter(const char* begin, const char* end);
+
+#endif
@@ -0,0 +1,95 @@
+#include "evaluator.h"
+#include "thread_pool.h"
+
+// Constructor for AsyncEvaluator
+AsyncEvaluator::AsyncEvaluator(const DatasetView& trainsetIn, const DatasetView& validationIn, bool backgroundIn)
+    : trainset(trainsetIn), validation(validationIn), background(backgroundIn) {
+    if (background) worker = std::thread(&AsyncEvaluator::work, this);
+}
+// Drop anything still queued and stop the worker
+AsyncEvaluator::~AsyncEvaluator() {
+    if (!background) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.reset();
+        stopping = true;
+        changed.notify_all();
+    }
+    worker.join();
+}
+
+// Training loss then validation accuracy of a snapshot
+Evaluation AsyncEvaluator::evaluate(std::shared_ptr<NeuralNetwork> network, size_t epoch) {
+    Evaluation result;
+    result.epoch = epoch;
+    result.network = network;
+    result.start = Telemetry::Clock::now();
+    result.loss = network->loss(trainset);
+    result.lossEnd = Telemetry::Clock::now();
+    Metrics metrics = network->evaluate(validation);
+    result.accuracy = metrics.accuracy();
+    result.validationLoss = metrics.loss();
+    result.end = Telemetry::Clock::now();
+    return result;
+}
+
+// Worker thread body, evaluates snapshots one at a time in the order they were submitted
+void AsyncEvaluator::work() {
+    run_loops_inline(); // the pool stays free for the learning steps
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        changed.wait(lock, [this]() {return pending || stopping;});
+        if (!pending) return;
+
+        std::shared_ptr<NeuralNetwork> network;
+        network.swap(pending);
+        size_t epoch = pendingEpoch;
+        busy = true;
+        changed.notify_all();
+        lock.unlock();
+
+        try {
+            Evaluation result = evaluate(network, epoch);
+            lock.lock();
+            results.push_back(result);
+        } catch (...) {
+            lock.lock();
+            if (!error) error = std::current_exception();
+        }
+        busy = false;
+        changed.notify_all();
+    }
+}
+
+// Snapshot the weights for evaluation
+void AsyncEvaluator::submit(const NeuralNetwork& nn, size_t epoch) {
+    std::shared_ptr<NeuralNetwork> snapshot(nn.clone());
+    if (!background) {
+        results.push_back(evaluate(snapshot, epoch));
+        return;
+    }
+
+    // at most one snapshot waits, so training never runs far ahead of the evaluations
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this]() {return !pending || error;});
+    pending = snapshot;
+    pendingEpoch = epoch;
+    changed.notify_all();
+}
+
+// Take the next finished evaluation without waiting
+bool AsyncEvaluator::poll(Evaluation& result) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (error) std::rethrow_exception(error);
+    if (results.empty()) return false;
+    result = results.front();
+    results.pop_front();
+    return true;
+}
+
+// Wait for every submitted snapshot to be evaluated
+void AsyncEvaluator::finish() {
+    if (!background) return;
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this]() {return (!pending && !busy) || error;});
+}
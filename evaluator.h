@@ -0,0 +1,61 @@
+#ifndef EVALUATOR_H
+#define EVALUATOR_H
+
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include "neural_network.h"
+#include "dataset.h"
+#include "telemetry.h"
+
+// Training loss and validation accuracy of a snapshot of the weights taken after an epoch
+struct Evaluation {
+    public:
+        size_t epoch;
+        double loss;
+        double accuracy; // on the validation rows
+        double validationLoss; // what picks the weights to keep
+        Telemetry::Clock::time_point start, lossEnd, end; // loss ran from start to lossEnd, then the validation
+        std::shared_ptr<NeuralNetwork> network; // the snapshot that was evaluated
+};
+
+// Evaluates snapshots of a network on a background thread while training carries on
+// the background thread runs its loops inline, so the learning steps keep the thread pool
+// without a background thread snapshots are evaluated as soon as they are submitted
+struct AsyncEvaluator {
+    private:
+        DatasetView trainset;
+        DatasetView validation;
+        bool background;
+
+        std::thread worker;
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::shared_ptr<NeuralNetwork> pending; // snapshot waiting for the worker
+        size_t pendingEpoch = 0;
+        bool busy = false;
+        bool stopping = false;
+        std::deque<Evaluation> results; // finished, not yet polled
+        std::exception_ptr error;
+
+        Evaluation evaluate(std::shared_ptr<NeuralNetwork> network, size_t epoch);
+        void work(); // worker thread body
+    public:
+        AsyncEvaluator(const DatasetView& trainsetIn, const DatasetView& validationIn, bool backgroundIn);
+        ~AsyncEvaluator();
+        AsyncEvaluator(const AsyncEvaluator&) = delete;
+        AsyncEvaluator& operator=(const AsyncEvaluator&) = delete;
+
+        // snapshot the weights for evaluation, waits only while an earlier snapshot is still queued
+        void submit(const NeuralNetwork& nn, size_t epoch);
+        // take the next finished evaluation in epoch order without waiting, false when there is none
+        // rethrows an exception raised while evaluating
+        bool poll(Evaluation& result);
+        // wait for every submitted snapshot to be evaluated
+        void finish();
+};
+
+#endif
@@ -1,16 +1,29 @@
 #include "config.h"
 #include "neural_network.h"
 #include "commands.h"
+#include "thread_pool.h"
+#include "checkpoint.h"
+#include "streaming_dataset.h"
+#include "telemetry.h"
+#include "dataset.h"
+#include "predict.h"
+#include "sampling.h"
+#include "crossval.h"
+#include "sweep.h"
 #include <iostream>
-#include <fstream>
 #include <sstream>
 #include <algorithm>
 #include <functional>
-#include <random>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
 
 std::string filename = FILENAME;
 std::vector<std::string> features = FEATURES;
 std::vector<std::string> classes = CLASSES;
+std::unique_ptr<Telemetry> telemetry;
 
 
 // Command for getting help
@@ -22,64 +35,53 @@ void cmd_help() {
     " help - this\n"
     " info - show information about the dataset and neural network\n"
     " train - neural network will try to converge\n"
+    " crossval - train and test fresh copies of the network on k folds of the dataset\n"
+    " sweep - train networks for a grid of layer sizes, learn rates and iterations and rank them\n"
+    " prune - drop the smallest weights, optionally fine-tuning the rest, for sparse inference\n"
     " test - check the classification of inputted features\n"
+    " save - write the neural network to a checkpoint file\n"
+    " load - read the neural network from a checkpoint file\n"
     " options - selection of editing the dataset and neural network\n"
     "\n"
+    "run 'main --predict model.bin [rows.csv]' to score rows from a file or stdin\n"
     "edit config.h and recompile for other options\n";
 }
 
-// Clean whitespace from string
-std::string remove_whitespace(const std::string& str) {
-    std::string result;
-    std::remove_copy_if(str.begin(), str.end(), std::back_inserter(result), ::isspace);
-    return result;
+// Read dataset using filename and class names from config.h
+Dataset get_dataset(std::string filename, std::vector<std::string> classes, NormalizationType normalization = NORMALIZATION) {
+    CsvSchema schema;
+    schema.delimiter = DELIMITER;
+    schema.labelColumn = LABEL_COLUMN;
+    schema.classes = classes;
+    schema.normalization = normalization;
+    return DATASET_CACHE ? get_dataset_cached(filename, schema) : get_dataset(filename, schema);
 }
 
-// Read dataset using filename and class names
-std::vector<DataInstance> get_dataset(std::string filename, std::vector<std::string> classes) {
-    // Open the file containing the data
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        std::cerr << ("Failed to Read Input File\n");
-        exit(-1);
-    }
-
-    // Initialize dataset vectors for features and classes
-    std::vector<DataInstance> dataset;
-
-    // Populate dataset with features and classes from the file
-    std::string line;
-    while (std::getline(file, line)) {
-        std::istringstream iss(line);
-        std::vector<std::string> tokens;
-        std::string token;
-        while (std::getline(iss, token, DELIMITER))
-            tokens.push_back(remove_whitespace(token));
-        
-        DataInstance instance_data;
-        for(auto& token : tokens) {
-            if (token != tokens.back())
-                instance_data.features.push_back(std::stod(token));
-            else 
-                for (size_t i=0; i<classes.size(); i++)
-                    if (classes[i].compare(token) == 0)
-                        instance_data.label = i;
-        } dataset.push_back(instance_data);
-    } file.close(); // Close file
-
-    return dataset;
-}
-
-void train_test_split(std::vector<DataInstance>& dataset, std::vector<DataInstance>& train_set, std::vector<DataInstance>& test_set) {
-    // Randomly shuffle the dataset to distribute the data
-    std::shuffle(dataset.begin(), dataset.end(), std::default_random_engine(RANDOM_SEED));
-
-    // Split into training set and testing set
-    int split_index = 0.6 * dataset.size();
-    train_set = std::vector<DataInstance>(dataset.begin(), dataset.begin()+split_index);
-    test_set = std::vector<DataInstance>(dataset.begin()+split_index, dataset.end());
-}
-void resample(std::vector<DataInstance>& dataset) {
+// Split the selected rows into training and testing rows, keeping the class proportions in both
+void train_test_split(const Dataset& dataset, const std::vector<size_t>& rows,
+    std::vector<size_t>& train_rows, std::vector<size_t>& test_rows) {
+    RandomStream random = random_stream(DATA_SPLIT); // the same split every time
+    stratified_split(dataset, rows, TEST_FRACTION, random, train_rows, test_rows);
+}
+// Hold a validation slice out of the training rows for train() to choose its weights on
+void train_validation_split(const DatasetView& trainset, std::vector<size_t>& fit_rows, std::vector<size_t>& validation_rows) {
+    std::vector<size_t> rows(trainset.size());
+    for (size_t i=0; i<rows.size(); i++) rows[i] = trainset.row(i);
+    RandomStream random = random_stream(VALIDATION_SPLIT); // the same slice every time
+    validation_split(*trainset.data, rows, VALIDATION_FRACTION, random, fit_rows, validation_rows);
+}
+// Weight init run of the next network the console randomizes, the startup network is run 0
+uint64_t next_run() {
+    static uint64_t runs = 0;
+    return ++runs;
+}
+// Select every row of the dataset
+std::vector<size_t> all_rows(const Dataset& dataset) {
+    std::vector<size_t> rows(dataset.size());
+    for (size_t i=0; i<rows.size(); i++) rows[i] = i;
+    return rows;
+}
+void resample(const Dataset& dataset, std::vector<size_t>& rows) {
     std::string user_input;
     double ratio;
 
@@ -87,28 +89,13 @@ void resample(std::vector<DataInstance>& dataset) {
     std::getline(std::cin, user_input);
     ratio = user_input.empty() ? 1.0 : std::stod(user_input);
 
-    std::vector<std::vector<DataInstance>> subsets;
-    for (size_t i=0; i<classes.size(); i++) {
-        std::vector<DataInstance> subset;
-        std::copy_if(dataset.begin(), dataset.end(), std::back_inserter(subset), [i](DataInstance x) {
-            return x.label == (int)i;});
-        subsets.push_back(subset);
-    }
-
-    size_t target = dataset.size()*ratio / subsets.size();
-
-    for (size_t i=0; i<subsets.size(); i++) {
-        // oversample minority subsets
-        for (size_t j=subsets[i].size(); j<target; j++)
-            dataset.push_back(subsets[i][rand()%subsets[i].size()]);
-        // undersample majority subsets
-        for (size_t j=subsets[i].size(); j>target; j--)
-            dataset.erase(std::find_if(dataset.begin(), dataset.end(), [i](DataInstance x) {
-                return x.label == (int)i; }));   
-    }
+    // a fresh stream for every resampling
+    static uint64_t resamples = 0;
+    RandomStream random = random_stream(RESAMPLING, resamples++);
+    rows = resample_rows(dataset, rows, ratio, random);
 }
 
-void cmd_train(NeuralNetwork* nn, std::vector<DataInstance> trainset, std::vector<DataInstance> testset) {
+void cmd_train(NeuralNetwork* nn, const DatasetView& trainset, const DatasetView& testset) {
     std::string user_input;
     size_t max_iteration;
     double learn_rate;
@@ -117,11 +104,223 @@ void cmd_train(NeuralNetwork* nn, std::vector<DataInstance> trainset, std::vecto
     std::getline(std::cin, user_input);
     max_iteration = user_input.empty() ? 100 : std::stoi(user_input);
 
-    std::cout << "enter learn rate: (default=1.0): ";
+    double default_rate = default_learn_rate(nn->optimizer.type);
+    std::cout << "enter learn rate: (default=" << default_rate << "): ";
+    std::getline(std::cin, user_input);
+    learn_rate = user_input.empty() ? default_rate : std::stod(user_input);
+
+    std::cout << "enter checkpoint file (default=none): ";
+    std::string checkpoint;
+    std::getline(std::cin, checkpoint);
+
+    std::vector<size_t> fit_rows, validation_rows;
+    train_validation_split(trainset, fit_rows, validation_rows);
+
+    nn->telemetry = telemetry.get();
+    nn->train(DatasetView(*trainset.data, fit_rows), DatasetView(*trainset.data, validation_rows),
+        max_iteration, learn_rate, checkpoint);
+    printf("test accuracy: %f\n", nn->test(testset));
+}
+// Command for stratified k-fold cross-validation of the network's layout and optimizer
+void cmd_crossval(NeuralNetwork* nn, const Dataset& dataset, const std::vector<size_t>& rows) {
+    std::string user_input;
+    CrossValidation settings;
+    settings.random = random_stream(DATA_SPLIT, 1); // the same folds every time
+    settings.validationFraction = VALIDATION_FRACTION;
+
+    std::cout << "enter number of folds (default=5): ";
+    std::getline(std::cin, user_input);
+    settings.folds = user_input.empty() ? 5 : std::stoi(user_input);
+
+    std::cout << "enter max iteration (default=100): ";
+    std::getline(std::cin, user_input);
+    settings.maxIteration = user_input.empty() ? 100 : std::stoi(user_input);
+
+    double default_rate = default_learn_rate(nn->optimizer.type);
+    std::cout << "enter learn rate: (default=" << default_rate << "): ";
+    std::getline(std::cin, user_input);
+    settings.learnRate = user_input.empty() ? default_rate : std::stod(user_input);
+
+    std::cout << "enter resampling ratio for the training folds (default=none): ";
+    std::getline(std::cin, user_input);
+    settings.resampleRatio = user_input.empty() ? 0.0 : std::stod(user_input);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<FoldResult> results = cross_validate(*nn, dataset, rows, settings);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("[CROSS VALIDATION] (%ld folds, %ld threads)\n", results.size(), std::min(results.size(), thread_pool().size()));
+    for (size_t f=0; f<results.size(); f++)
+        printf(" fold %-3ld [train:%ld] [test:%ld] [accuracy:%f] [%.3f s]\n", f+1,
+            results[f].trainSize, results[f].testSize, results[f].accuracy, results[f].seconds);
+    double mean, stddev;
+    accuracy_stats(results, mean, stddev);
+    printf(" accuracy: %f +- %f\n", mean, stddev);
+    printf(" total: %.3f s\n", seconds);
+}
+// Command for magnitude pruning the network, optionally fine-tuning the weights that are left
+void cmd_prune(NeuralNetwork* nn, const DatasetView& trainset, const DatasetView& testset) {
+    std::string user_input;
+
+    std::cout << "enter weight threshold, or sparsity of each layer with a '%' (eg. 0.05 or 80%): ";
+    std::getline(std::cin, user_input);
+    if (user_input.empty()) {printf("nothing pruned\n"); return;}
+
+    double accuracy = nn->test(testset);
+    if (user_input.back() == '%')
+        nn->prune_sparsity(std::stod(user_input.substr(0, user_input.size()-1)) / 100);
+    else
+        nn->prune(std::stod(user_input));
+    double pruned_accuracy = nn->test(testset);
+
+    // pruned weights stay at zero while the rest recover what they can
+    std::cout << "enter fine-tuning iterations (default=0): ";
+    std::getline(std::cin, user_input);
+    size_t iterations = user_input.empty() ? 0 : std::stoi(user_input);
+    if (iterations) {
+        double default_rate = default_learn_rate(nn->optimizer.type);
+        std::cout << "enter learn rate: (default=" << default_rate << "): ";
+        std::getline(std::cin, user_input);
+        double learn_rate = user_input.empty() ? default_rate : std::stod(user_input);
+
+        std::vector<size_t> fit_rows, validation_rows;
+        train_validation_split(trainset, fit_rows, validation_rows);
+
+        nn->telemetry = telemetry.get();
+        nn->train(DatasetView(*trainset.data, fit_rows), DatasetView(*trainset.data, validation_rows),
+            iterations, learn_rate, "");
+    }
+
+    printf("[PRUNE] (%.1f%% of the weights left)\n", 100 * nn->density());
+    for (size_t l=1; l<nn->layers.size(); l++) {
+        Layer* layer = nn->layers[l];
+        size_t kept = layer->sparse.empty() ? layer->weights.size() : layer->sparse.values.size();
+        printf(" layer %ld: %ld of %ld weights [%s kernel, %s batch kernel]\n", l, kept, layer->weights.size(),
+            layer->use_sparse() ? "sparse" : "dense", layer->use_sparse(true) ? "sparse" : "dense");
+    }
+    printf(" accuracy: %f before, %f pruned", accuracy, pruned_accuracy);
+    if (iterations) printf(", %f fine-tuned", nn->test(testset));
+    printf("\n");
+}
+// Read a line of values separated by spaces, or use the default values for an empty line
+template <class T>
+std::vector<T> read_values(const std::string& prompt, const std::vector<T>& defaults) {
+    std::string user_input;
+    std::cout << prompt;
+    std::getline(std::cin, user_input);
+
+    std::istringstream iss(user_input);
+    std::vector<T> values;
+    std::string token;
+    while (iss >> token) values.push_back((T)std::stod(token));
+    return values.empty() ? defaults : values;
+}
+// Command for searching layer sizes, learn rates and iteration budgets on many networks at once
+void cmd_sweep(NeuralNetwork* nn, const DatasetView& trainset, const DatasetView& testset) {
+    std::string user_input;
+    SweepSpace space;
+
+    printf("enter hidden layers to try, ';' between options (eg. 5; 8 8; 16:relu, default=5; 10; 5 5): ");
+    std::getline(std::cin, user_input);
+    if (user_input.empty()) user_input = "5; 10; 5 5";
+    std::istringstream options(user_input);
+    std::string option;
+    while (std::getline(options, option, ';')) {
+        std::istringstream iss(option);
+        std::vector<size_t> sizes;
+        std::vector<Activation> activations;
+        std::string token;
+        while (iss >> token) {
+            size_t colon = token.find(':');
+            sizes.push_back((size_t)std::stoi(token.substr(0, colon)));
+            activations.push_back(colon == std::string::npos ? HIDDEN_ACTIVATION : parse_activation(token.substr(colon+1)));
+        }
+        space.hiddenLayers.push_back(sizes);
+        space.hiddenActivations.push_back(activations);
+    }
+
+    double default_rate = default_learn_rate(nn->optimizer.type);
+    std::ostringstream rate_prompt;
+    rate_prompt << "enter learn rates (default=" << default_rate << "): ";
+    space.learnRates = read_values<double>(rate_prompt.str(), {default_rate});
+    space.maxIterations = read_values<size_t>("enter iteration budgets (default=100): ", {100});
+
+    printf("enter number of random combinations (default=0, the whole grid of %ld): ", space.grid_size());
+    std::getline(std::cin, user_input);
+    space.samples = user_input.empty() ? 0 : std::stoi(user_input);
+
+    std::cout << "enter checkpoint file for the best network (default=sweep.bin): ";
+    std::string checkpoint;
+    std::getline(std::cin, checkpoint);
+    if (checkpoint.empty()) checkpoint = "sweep.bin";
+
+    size_t numInputs = nn->layers.front()->nodes.size(), numOutputs = nn->layers.back()->nodes.size();
+    RandomStream random = random_stream(SEARCH);
+    std::vector<SweepTrial> trials = sweep_trials(space, numInputs, numOutputs, nn->layers.back()->activation, random);
+
+    std::vector<size_t> fit_rows, validation_rows;
+    train_validation_split(trainset, fit_rows, validation_rows);
+
+    auto start = std::chrono::steady_clock::now();
+    run_sweep(trials, nn->optimizer, DatasetView(*trainset.data, fit_rows), DatasetView(*trainset.data, validation_rows),
+        testset);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("[SWEEP] (%ld trials, %ld threads, %.3f s)\n", trials.size(), std::min(trials.size(), thread_pool().size()), seconds);
+    printf(" %-4s %-24s %-10s %-10s %-10s %-10s %-10s %s\n", "rank", "layers", "rate", "iterations", "validation",
+        "loss", "test", "seconds");
+    for (size_t t=0; t<trials.size(); t++) {
+        std::string layers;
+        for (size_t l=0; l<trials[t].layerSizes.size(); l++) {
+            layers += (l ? " " : "") + std::to_string(trials[t].layerSizes[l]);
+            if (l && trials[t].activations[l-1] != (l+1 < trials[t].layerSizes.size() ? HIDDEN_ACTIVATION : OUTPUT_ACTIVATION))
+                layers += std::string(":") + activation_name(trials[t].activations[l-1]);
+        }
+        printf(" %-4ld %-24s %-10g %-10ld %-10f %-10f %-10f %.3f\n", t+1, layers.c_str(), trials[t].learnRate,
+            trials[t].maxIteration, trials[t].validationAccuracy, trials[t].loss, trials[t].accuracy, trials[t].seconds);
+    }
+
+    save_checkpoint(*trials.front().network, checkpoint);
+    printf("best network saved to %s, 'load' it to keep working with it\n", checkpoint.c_str());
+}
+// Command for training on a file streamed from disk in chunks
+void cmd_stream_train(NeuralNetwork* nn) {
+    std::string user_input;
+
+    std::cout << "enter file to stream (default=" << filename << "): ";
     std::getline(std::cin, user_input);
-    learn_rate = user_input.empty() ? 1.0 : std::stoi(user_input);
+    std::string stream_file = user_input.empty() ? filename : user_input;
+
+    CsvSchema schema;
+    schema.delimiter = DELIMITER;
+    schema.labelColumn = LABEL_COLUMN;
+    schema.classes = classes;
+    StreamingDataset stream(stream_file, schema, STREAM_CHUNK_BYTES, STREAM_SHUFFLE_BUFFER, TEST_FRACTION, RANDOM_SEED);
+    if (stream.numFeatures != nn->layers.front()->nodes.size() || stream.classes.size() != nn->layers.back()->nodes.size()) {
+        printf("%s has %ld features and %ld classes, resize the neural network to match\n",
+            stream_file.c_str(), stream.numFeatures, stream.classes.size());
+        return;
+    }
+
+    std::cout << "enter epochs (default=10): ";
+    std::getline(std::cin, user_input);
+    size_t epochs = user_input.empty() ? 10 : std::stoi(user_input);
+
+    std::cout << "enter batch size (default=" << STREAM_BATCH_SIZE << "): ";
+    std::getline(std::cin, user_input);
+    size_t batch_size = user_input.empty() ? STREAM_BATCH_SIZE : std::stoi(user_input);
+
+    double default_rate = default_learn_rate(nn->optimizer.type);
+    std::cout << "enter learn rate: (default=" << default_rate << "): ";
+    std::getline(std::cin, user_input);
+    double learn_rate = user_input.empty() ? default_rate : std::stod(user_input);
+
+    std::cout << "enter checkpoint file (default=none): ";
+    std::string checkpoint;
+    std::getline(std::cin, checkpoint);
 
-    nn->train(trainset, testset, max_iteration, learn_rate);
+    nn->telemetry = telemetry.get();
+    nn->train(stream, epochs, batch_size, learn_rate, checkpoint);
 }
 // Command for manually testing a datapoint
 void cmd_test(NeuralNetwork* nn) {
@@ -136,6 +335,8 @@ void cmd_test(NeuralNetwork* nn) {
 
         inputs.push_back(std::stod(user_input));
     }
+    // scaled like the data the network trained on
+    if (nn->normalization.size() == inputs.size()) nn->normalization.apply(inputs.data());
 
     std::vector<double> output = nn->calculate(inputs);
 
@@ -145,49 +346,267 @@ void cmd_test(NeuralNetwork* nn) {
     std::cout << classes[maxIdx] << "\n";
 }
 // Command for printing the dataset
-void cmd_info(NeuralNetwork* nn, std::vector<DataInstance> dataset) {
+void cmd_info(NeuralNetwork* nn, const DatasetView& dataset) {
+    // class counts come from the confusion matrix of the same pass that scores the network
+    Metrics metrics = nn->evaluate(dataset);
+    size_t numClasses = std::min(classes.size(), metrics.numClasses);
+
     std::cout << "[DATASET INFORMATION]\n";
-    for (size_t i=0; i<classes.size(); i++) {
-        std::vector<DataInstance> subset;
-        std::copy_if(dataset.begin(), dataset.end(), std::back_inserter(subset), [i](DataInstance a) {
-            return a.label == (int)i;});
-        std::cout << " instances of " << classes[i] << ": " << subset.size() << "\n";
-    }
+    for (size_t i=0; i<numClasses; i++)
+        std::cout << " instances of " << classes[i] << ": " << metrics.actual(i) << "\n";
     std::cout << " total instances: " << dataset.size() << "\n";
+    std::cout << " normalization: " << normalization_name(dataset.data->normalization.type) << "\n";
 
     std::cout << "\n[NEURAL NETWORK INFORMATION]\n";
     printf(" layer sizes: "); for (auto& layer : nn->layers) printf("%ld ", layer->nodes.size()); printf("\n");
-    std::cout << " current accuracy (using whole dataset): " << nn->test(dataset) << "\n";
+    printf(" activations: "); for (size_t l=1; l<nn->layers.size(); l++) printf("%s ", activation_name(nn->layers[l]->activation)); printf("\n");
+    std::cout << " current accuracy (using whole dataset): " << metrics.accuracy() << "\n";
+    std::cout << " current loss (using whole dataset): " << metrics.loss() << "\n";
+
+    std::cout << "\n[PER CLASS]\n";
+    for (size_t i=0; i<numClasses; i++)
+        printf(" %-20s [precision:%f] [recall:%f]\n", classes[i].c_str(), metrics.precision(i), metrics.recall(i));
+    std::cout << " confusion matrix (rows actual, columns predicted):\n";
+    for (size_t a=0; a<numClasses; a++) {
+        printf("  ");
+        for (size_t p=0; p<numClasses; p++) printf("%8ld", metrics.confusion[a*metrics.numClasses + p]);
+        printf("\n");
+    }
+}
+// Command to compare the reduced precision inference paths against doubles
+void cmd_precision(NeuralNetwork* nn, const DatasetView& trainset, const DatasetView& testset) {
+    // int8 scales are calibrated on the training set
+    nn->quantize(trainset);
+
+    double reference = 0.0;
+    std::cout << "[INFERENCE PRECISION] (" << testset.size() << " test instances)\n";
+    for (auto [precision, name] : std::vector<std::pair<Precision, const char*>> {
+        {FLOAT64, "float64"}, {FLOAT32, "float32"}, {INT8, "int8"}}) {
+        auto start = std::chrono::steady_clock::now();
+        double accuracy = nn->test(testset, precision);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (precision == FLOAT64) reference = accuracy;
+        printf(" %-8s [accuracy:%f] [delta:%+f] [%.1f ns/instance]\n", name, accuracy, accuracy - reference,
+            seconds*1e9 / std::max<size_t>(testset.size(), 1));
+    }
+}
+// Command to save the neural network
+void cmd_save(NeuralNetwork* nn) {
+    std::string user_input;
+
+    printf("enter checkpoint file: ");
+    std::getline(std::cin, user_input);
+    if (user_input.empty()) {printf("nothing saved\n"); return;}
+
+    save_checkpoint(*nn, user_input);
+}
+// Command to load a saved neural network
+void cmd_load(NeuralNetwork*& nn, const Dataset& dataset) {
+    std::string user_input;
+
+    printf("enter checkpoint file: ");
+    std::getline(std::cin, user_input);
+    if (user_input.empty()) {printf("nothing loaded\n"); return;}
+
+    NeuralNetwork* loaded = load_checkpoint(user_input);
+    if (loaded->layers.front()->nodes.size() != features.size() || loaded->layers.back()->nodes.size() != classes.size())
+        printf("warning: checkpoint layer sizes don't match the dataset\n");
+    else if (loaded->normalization != dataset.normalization)
+        printf("warning: checkpoint was trained on features normalized differently from the dataset\n");
+
+    loaded->optimizer = nn->optimizer;
+    delete nn;
+    nn = loaded;
+}
+// Command to choose where training telemetry is written
+void cmd_telemetry() {
+    std::string log_file, trace_file;
+
+    printf("enter telemetry file, .csv for CSV (default=off): ");
+    std::getline(std::cin, log_file);
+    if (log_file.empty()) {telemetry.reset(); printf("telemetry off\n"); return;}
+
+    printf("enter trace file (default=none): ");
+    std::getline(std::cin, trace_file);
+
+    telemetry.reset(); // finish the previous trace before starting another
+    telemetry.reset(new Telemetry(log_file, trace_file));
+}
+// Command to change the number of training threads
+void cmd_threads() {
+    std::string user_input;
 
+    printf("enter thread count (currently %ld, 0=all cores): ", thread_pool().size());
+    std::getline(std::cin, user_input);
+    if (user_input.empty()) return;
+
+    thread_pool().resize((size_t)std::stoi(user_input));
+}
+// Command to choose the optimizer and learn rate schedule
+void cmd_optimizer(NeuralNetwork* nn) {
+    std::string user_input;
+    Optimizer& optimizer = nn->optimizer;
+
+    printf("enter optimizer, sgd momentum nesterov adam or adamw (currently %s): ", optimizer_name(optimizer.type));
+    std::getline(std::cin, user_input);
+    if (!user_input.empty()) optimizer.type = parse_optimizer(user_input);
+
+    printf("enter schedule, constant step or cosine (currently %s): ", schedule_name(optimizer.schedule.type));
+    std::getline(std::cin, user_input);
+    if (!user_input.empty()) optimizer.schedule.type = parse_schedule(user_input);
+
+    printf("enter warmup steps (currently %ld): ", optimizer.schedule.warmupSteps);
+    std::getline(std::cin, user_input);
+    if (!user_input.empty()) optimizer.schedule.warmupSteps = std::stoul(user_input);
+
+    if (optimizer.schedule.type == STEP) {
+        printf("enter steps between decays (currently %ld): ", optimizer.schedule.stepSize);
+        std::getline(std::cin, user_input);
+        if (!user_input.empty()) optimizer.schedule.stepSize = std::stoul(user_input);
+
+        printf("enter decay (currently %g): ", optimizer.schedule.decay);
+        std::getline(std::cin, user_input);
+        if (!user_input.empty()) optimizer.schedule.decay = std::stod(user_input);
+    } else if (optimizer.schedule.type == COSINE) {
+        printf("enter final fraction of the learn rate (currently %g): ", optimizer.schedule.minFraction);
+        std::getline(std::cin, user_input);
+        if (!user_input.empty()) optimizer.schedule.minFraction = std::stod(user_input);
+    }
+    if (optimizer.type == ADAMW) {
+        printf("enter weight decay (currently %g): ", optimizer.weightDecay);
+        std::getline(std::cin, user_input);
+        if (!user_input.empty()) optimizer.weightDecay = std::stod(user_input);
+    }
 }
 // Command to resize the neural network
 void cmd_resize(NeuralNetwork*& nn) {
     std::string user_input;
 
-    printf("enter new architecture (eg. 4 5 3): ");
+    printf("enter new architecture, optionally with activations (eg. 4 5 3 or 4 8:relu 3:softmax): ");
     std::getline(std::cin, user_input);
 
     std::istringstream iss(user_input);
     std::vector<size_t> layer_sizes;
+    std::vector<std::string> activation_names;
 
     std::string token;
-    while (std::getline(iss, token, ' '))
-        layer_sizes.push_back((size_t)std::stoi(token));
+    while (iss >> token) {
+        size_t colon = token.find(':');
+        layer_sizes.push_back((size_t)std::stoi(token.substr(0, colon)));
+        activation_names.push_back(colon == std::string::npos ? "" : token.substr(colon+1));
+    }
+    if (layer_sizes.size() < 2) {printf("a network needs an input and an output layer\n"); return;}
+
+    // layers without an activation use the ones in config.h
+    std::vector<Activation> activations;
+    for (size_t l=1; l<layer_sizes.size(); l++) {
+        Activation activation = l+1 < layer_sizes.size() ? HIDDEN_ACTIVATION : OUTPUT_ACTIVATION;
+        if (!activation_names[l].empty()) activation = parse_activation(activation_names[l]);
+        activations.push_back(activation);
+    }
 
+    // keep the optimizer settings
+    NeuralNetwork* resized = new NeuralNetwork(layer_sizes, activations, next_run());
+    resized->optimizer = nn->optimizer;
     delete nn;
-    nn = new NeuralNetwork(layer_sizes);
+    nn = resized;
 }
 
-int main() {
-    std::srand(RANDOM_SEED); // seed random
+// Score CSV rows from a file or stdin with a saved network, writing predictions to stdout
+int run_predict(int argc, char** argv) {
+    PredictOptions options;
+    options.batchSize = PREDICT_BATCH_SIZE;
+    options.timeout = PREDICT_TIMEOUT;
+    options.delimiter = DELIMITER;
+    options.labelColumn = LABEL_COLUMN;
+    options.classes = classes;
+
+    std::string model = argv[2], input;
+    try {
+        for (int i=3; i<argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--probabilities") options.probabilities = true;
+            else if (arg == "--batch" && i+1 < argc) options.batchSize = std::stoul(argv[++i]);
+            else if (arg == "--timeout" && i+1 < argc) options.timeout = std::stod(argv[++i]);
+            else if (arg == "--precision" && i+1 < argc) {
+                std::string precision = argv[++i];
+                if (precision == "float32") options.precision = FLOAT32;
+                else if (precision == "int8") options.precision = INT8;
+                else if (precision != "float64") throw std::invalid_argument("unknown precision '" + precision + "'");
+            }
+            else if (input.empty() && arg[0] != '-') input = arg;
+            else throw std::invalid_argument("unknown argument '" + arg + "'");
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "usage: " << argv[0] << " --predict model.bin [rows.csv] [--probabilities]"
+            " [--batch rows] [--timeout seconds] [--precision float64|float32|int8]\n";
+        return -1;
+    }
 
-    // Read dataset from file
-    std::vector<DataInstance> dataset = get_dataset(filename, classes);
-    std::vector<DataInstance> train_set;
-    std::vector<DataInstance> test_set;
+    int fd = 0; // stdin
+    if (!input.empty() && (fd = open(input.c_str(), O_RDONLY)) < 0) {
+        std::cerr << "Failed to Read Input File: " << input << ": " << std::strerror(errno) << "\n";
+        return -1;
+    }
+    try {
+        std::unique_ptr<NeuralNetwork> nn(load_checkpoint(model));
+
+        // the dataset from config.h names the classes when CLASSES leaves them to the file, like train and test print them
+        // int8 scales are calibrated on it too, scaled with the model's normalization like the rows it will predict
+        Dataset calibration;
+        if (options.precision == INT8) {
+            calibration = get_dataset(filename, classes, NO_NORMALIZATION);
+            if (nn->normalization.size() == calibration.numFeatures()) {
+                nn->normalization.apply(calibration.features.data.data(), calibration.size());
+                calibration.normalization = nn->normalization;
+            }
+        }
+        else if (classes.empty()) {
+            try {
+                calibration = get_dataset(filename, classes);
+            } catch (const std::exception& e) {
+                std::cerr << "warning: printing class indices, " << e.what() << "\n";
+            }
+        }
+        if (options.classes.empty()) options.classes = calibration.classes;
+        if (options.precision != FLOAT64) nn->quantize(calibration);
+
+        predict_stream(*nn, fd, stdout, options);
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to Predict: " << e.what() << "\n";
+        if (fd) close(fd);
+        return -1;
+    }
+    if (fd) close(fd);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    // headless scoring, no dataset or console needed
+    if (argc >= 3 && std::string(argv[1]) == "--predict")
+        return run_predict(argc, argv);
+
+    // Read dataset from file, the sets below select rows of it by index
+    Dataset dataset;
+    std::vector<size_t> rows, train_rows, test_rows;
+    try {
+        dataset = get_dataset(filename, classes);
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to Read Input File: " << e.what() << "\n";
+        return -1;
+    }
+    classes = dataset.classes;
+    for (size_t i=features.size(); i<dataset.numFeatures(); i++)
+        features.push_back("Feature-" + std::to_string(i+1));
+    features.resize(dataset.numFeatures());
 
     // split dataset for training and testing
-    train_test_split(dataset, train_set, test_set);
+    rows = all_rows(dataset);
+    train_test_split(dataset, rows, train_rows, test_rows);
+
+    // Training telemetry from config.h
+    if (std::string(TELEMETRY_FILE) != "")
+        telemetry.reset(new Telemetry(TELEMETRY_FILE, TRACE_FILE));
 
     // Initialize neural network
     NeuralNetwork* nn = new NeuralNetwork(NEURAL_NETWORK_LAYERS);
@@ -195,30 +614,54 @@ int main() {
     // Initialize command console with its commands
     Console console(
         std::vector<Command*> {
-            new Command("info", [&nn, &dataset]() {
-                cmd_info(nn, dataset); }),
-            new Command("train", [&nn, &train_set, &test_set]() {
-                cmd_train(nn, train_set, test_set); }),
+            new Command("info", [&nn, &dataset, &rows]() {
+                cmd_info(nn, DatasetView(dataset, rows)); }),
+            new Command("train", [&nn, &dataset, &train_rows, &test_rows]() {
+                cmd_train(nn, DatasetView(dataset, train_rows), DatasetView(dataset, test_rows)); }),
+            new Command("crossval", [&nn, &dataset, &rows]() {
+                cmd_crossval(nn, dataset, rows); }),
+            new Command("sweep", [&nn, &dataset, &train_rows, &test_rows]() {
+                cmd_sweep(nn, DatasetView(dataset, train_rows), DatasetView(dataset, test_rows)); }),
+            new Command("prune", [&nn, &dataset, &train_rows, &test_rows]() {
+                cmd_prune(nn, DatasetView(dataset, train_rows), DatasetView(dataset, test_rows)); }),
             new Command("test", [&nn]() {
                 cmd_test(nn); }),
+            new Command("save", [&nn]() {
+                cmd_save(nn); }),
+            new Command("load", [&nn, &dataset]() {
+                cmd_load(nn, dataset); }),
             new Option_Command("options", std::vector<Command*> {
                 new Option_Command("dataset options", std::vector<Command*> {
-                    new Command("split into training and testing sets", [&dataset, &train_set, &test_set]() {
-                        train_test_split(dataset, train_set, test_set); }),
-                    new Command("balance with resampling", [&dataset]() {
-                        resample(dataset); }),
-                    new Command("reimport dataset", [&dataset]() {
-                        dataset = get_dataset(filename, classes); }),
+                    new Command("split into training and testing sets", [&dataset, &rows, &train_rows, &test_rows]() {
+                        train_test_split(dataset, rows, train_rows, test_rows); }),
+                    new Command("balance with resampling", [&dataset, &rows]() {
+                        resample(dataset, rows); }),
+                    new Command("reimport dataset", [&dataset, &rows, &train_rows, &test_rows]() {
+                        dataset = get_dataset(filename, classes);
+                        rows = all_rows(dataset);
+                        train_test_split(dataset, rows, train_rows, test_rows); }),
+                    new Command("train by streaming a file", [&nn]() {
+                        cmd_stream_train(nn); }),
                 }),
                 new Option_Command("neural network options", std::vector<Command*> {
                     new Command("change layer sizes", [&nn]() {
                         cmd_resize(nn); }),
                     new Command("randomize weights and biases", [&nn]() {
-                        nn->randomize(); }),
+                        nn->randomize(next_run()); }),
                     new Command("test input", [&nn]() {
                         cmd_test(nn); }),
                     new Command("dump", [&nn]() {
                         nn->show(); }),
+                    new Command("set optimizer", [&nn]() {
+                        cmd_optimizer(nn); }),
+                    new Command("set thread count", []() {
+                        cmd_threads(); }),
+                    new Command("set telemetry files", []() {
+                        cmd_telemetry(); }),
+                    new Command("compare inference precisions", [&nn, &dataset, &train_rows, &test_rows]() {
+                        cmd_precision(nn, DatasetView(dataset, train_rows), DatasetView(dataset, test_rows)); }),
+                    new Command("gradient check", [&nn, &dataset, &train_rows]() {
+                        printf("maximum gradient deviation: %e\n", nn->gradient_check(DatasetView(dataset, train_rows))); }),
                 }),
             }),
             new Command("help", []() {
@@ -0,0 +1,37 @@
+#include "mapped_file.h"
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Map the whole file
+MappedFile::MappedFile(const std::string& filename, bool copyOnWrite) : data(nullptr), size(0) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("failed to open " + filename);
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw std::runtime_error("failed to stat " + filename);
+    }
+    size = info.st_size;
+
+    // mmap rejects empty mappings, an empty file is just an empty range
+    if (size > 0) {
+        int protection = copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ;
+        void* mapping = mmap(nullptr, size, protection, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("failed to map " + filename);
+        }
+        madvise(mapping, size, MADV_SEQUENTIAL);
+        data = static_cast<char*>(mapping);
+    }
+    close(fd); // the mapping stays valid after closing
+}
+
+MappedFile::~MappedFile() {
+    if (data) munmap(data, size);
+}
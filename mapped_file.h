@@ -0,0 +1,24 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+
+// Memory mapping of a whole file, read-only or private copy-on-write
+struct MappedFile {
+    public:
+        char* data;
+        size_t size;
+
+        // throws std::runtime_error when the file can't be opened or mapped
+        // copy-on-write mappings share pages with other processes until they are written to
+        MappedFile(const std::string& filename, bool copyOnWrite=false);
+        ~MappedFile();
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        const char* begin() const {return data;}
+        const char* end() const {return data + size;}
+};
+
+#endif
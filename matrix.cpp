@@ -0,0 +1,310 @@
+#include "matrix.h"
+#include <algorithm>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Block sizes chosen so a block of a and b stays resident in L1/L2
+static const size_t BLOCK_ROWS = 64;
+static const size_t BLOCK_COLS = 64;
+static const size_t BLOCK_DEPTH = 256;
+
+#ifdef __AVX2__
+// Sum the four lanes of a vector
+static inline double horizontal_sum(__m256d x) {
+    __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(x), _mm256_extractf128_pd(x, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+}
+static inline float horizontal_sum(__m256 x) {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    return _mm_cvtss_f32(_mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1)));
+}
+static inline int32_t horizontal_sum(__m256i x) {
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+    sum = _mm_add_epi32(sum, _mm_unpackhi_epi64(sum, sum));
+    return _mm_cvtsi128_si32(_mm_add_epi32(sum, _mm_shuffle_epi32(sum, 1)));
+}
+#endif
+
+// Accumulate a 4x2 tile of dot products over depth [0, k)
+static inline void kernel_4x2(const double* a, size_t lda, const double* b, size_t ldb,
+    double* c, size_t ldc, size_t k) {
+    size_t p = 0;
+    double sums[4][2] = {};
+#ifdef __AVX2__
+    __m256d acc[4][2];
+    for (auto& row : acc) for (auto& x : row) x = _mm256_setzero_pd();
+    for (; p+4<=k; p+=4) {
+        __m256d b0 = _mm256_loadu_pd(b + p);
+        __m256d b1 = _mm256_loadu_pd(b + ldb + p);
+        for (size_t i=0; i<4; i++) {
+            __m256d ai = _mm256_loadu_pd(a + i*lda + p);
+            acc[i][0] = _mm256_fmadd_pd(ai, b0, acc[i][0]);
+            acc[i][1] = _mm256_fmadd_pd(ai, b1, acc[i][1]);
+        }
+    }
+    for (size_t i=0; i<4; i++)
+        for (size_t j=0; j<2; j++)
+            sums[i][j] = horizontal_sum(acc[i][j]);
+#endif
+    for (; p<k; p++)
+        for (size_t i=0; i<4; i++)
+            for (size_t j=0; j<2; j++)
+                sums[i][j] += a[i*lda + p] * b[j*ldb + p];
+
+    for (size_t i=0; i<4; i++)
+        for (size_t j=0; j<2; j++)
+            c[i*ldc + j] += sums[i][j];
+}
+// The same tile in float32, twice the lanes per instruction
+static inline void kernel_4x2(const float* a, size_t lda, const float* b, size_t ldb,
+    float* c, size_t ldc, size_t k) {
+    size_t p = 0;
+    float sums[4][2] = {};
+#ifdef __AVX2__
+    __m256 acc[4][2];
+    for (auto& row : acc) for (auto& x : row) x = _mm256_setzero_ps();
+    for (; p+8<=k; p+=8) {
+        __m256 b0 = _mm256_loadu_ps(b + p);
+        __m256 b1 = _mm256_loadu_ps(b + ldb + p);
+        for (size_t i=0; i<4; i++) {
+            __m256 ai = _mm256_loadu_ps(a + i*lda + p);
+            acc[i][0] = _mm256_fmadd_ps(ai, b0, acc[i][0]);
+            acc[i][1] = _mm256_fmadd_ps(ai, b1, acc[i][1]);
+        }
+    }
+    for (size_t i=0; i<4; i++)
+        for (size_t j=0; j<2; j++)
+            sums[i][j] = horizontal_sum(acc[i][j]);
+#endif
+    for (; p<k; p++)
+        for (size_t i=0; i<4; i++)
+            for (size_t j=0; j<2; j++)
+                sums[i][j] += a[i*lda + p] * b[j*ldb + p];
+
+    for (size_t i=0; i<4; i++)
+        for (size_t j=0; j<2; j++)
+            c[i*ldc + j] += sums[i][j];
+}
+// The same tile in int8, widened to 16 bits and accumulated exactly in 32 bit lanes
+static inline void kernel_4x2(const int8_t* a, size_t lda, const int8_t* b, size_t ldb,
+    int32_t* c, size_t ldc, size_t k) {
+    size_t p = 0;
+    int32_t sums[4][2] = {};
+#ifdef __AVX2__
+    __m256i acc[4][2];
+    for (auto& row : acc) for (auto& x : row) x = _mm256_setzero_si256();
+    for (; p+16<=k; p+=16) {
+        __m256i b0 = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + p)));
+        __m256i b1 = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + ldb + p)));
+        for (size_t i=0; i<4; i++) {
+            __m256i ai = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i*lda + p)));
+            acc[i][0] = _mm256_add_epi32(acc[i][0], _mm256_madd_epi16(ai, b0));
+            acc[i][1] = _mm256_add_epi32(acc[i][1], _mm256_madd_epi16(ai, b1));
+        }
+    }
+    // a half width step for the 8 to 15 values left, narrow layers rarely fill a whole vector
+    if (p+8 <= k) {
+        __m256i b0 = _mm256_cvtepi8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + p)));
+        __m256i b1 = _mm256_cvtepi8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + ldb + p)));
+        for (size_t i=0; i<4; i++) {
+            __m256i ai = _mm256_cvtepi8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + i*lda + p)));
+            acc[i][0] = _mm256_add_epi32(acc[i][0], _mm256_madd_epi16(ai, b0));
+            acc[i][1] = _mm256_add_epi32(acc[i][1], _mm256_madd_epi16(ai, b1));
+        }
+        p += 8;
+    }
+    for (size_t i=0; i<4; i++)
+        for (size_t j=0; j<2; j++)
+            sums[i][j] = horizontal_sum(acc[i][j]);
+#endif
+    for (; p<k; p++)
+        for (size_t i=0; i<4; i++)
+            for (size_t j=0; j<2; j++)
+                sums[i][j] += a[i*lda + p] * b[j*ldb + p];
+
+    for (size_t i=0; i<4; i++)
+        for (size_t j=0; j<2; j++)
+            c[i*ldc + j] += sums[i][j];
+}
+// Dot product of two vectors of length k
+double dot(const double* a, const double* b, size_t k) {
+    size_t p = 0;
+    double sum = 0.0;
+#ifdef __AVX2__
+    // independent accumulators hide the latency of the fused multiply-adds
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    __m256d acc2 = _mm256_setzero_pd(), acc3 = _mm256_setzero_pd();
+    for (; p+16<=k; p+=16) {
+        acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + p), _mm256_loadu_pd(b + p), acc0);
+        acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + p + 4), _mm256_loadu_pd(b + p + 4), acc1);
+        acc2 = _mm256_fmadd_pd(_mm256_loadu_pd(a + p + 8), _mm256_loadu_pd(b + p + 8), acc2);
+        acc3 = _mm256_fmadd_pd(_mm256_loadu_pd(a + p + 12), _mm256_loadu_pd(b + p + 12), acc3);
+    }
+    for (; p+4<=k; p+=4)
+        acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + p), _mm256_loadu_pd(b + p), acc0);
+    sum = horizontal_sum(_mm256_add_pd(_mm256_add_pd(acc0, acc1), _mm256_add_pd(acc2, acc3)));
+#endif
+    for (; p<k; p++)
+        sum += a[p] * b[p];
+    return sum;
+}
+
+float dot(const float* a, const float* b, size_t k) {
+    size_t p = 0;
+    float sum = 0.0f;
+#ifdef __AVX2__
+    // twice the lanes of the double kernel per instruction
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps(), acc3 = _mm256_setzero_ps();
+    for (; p+32<=k; p+=32) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + p), _mm256_loadu_ps(b + p), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + p + 8), _mm256_loadu_ps(b + p + 8), acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + p + 16), _mm256_loadu_ps(b + p + 16), acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + p + 24), _mm256_loadu_ps(b + p + 24), acc3);
+    }
+    for (; p+8<=k; p+=8)
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + p), _mm256_loadu_ps(b + p), acc0);
+    sum = horizontal_sum(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+#endif
+    for (; p<k; p++)
+        sum += a[p] * b[p];
+    return sum;
+}
+int32_t dot(const int8_t* a, const int8_t* b, size_t k) {
+    size_t p = 0;
+    int32_t sum = 0;
+#ifdef __AVX2__
+    // widen to 16 bits, multiply and add adjacent pairs into 32 bit lanes
+    __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+    for (; p+32<=k; p+=32) {
+        __m256i a0 = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + p)));
+        __m256i b0 = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + p)));
+        __m256i a1 = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + p + 16)));
+        __m256i b1 = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + p + 16)));
+        acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(a0, b0));
+        acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(a1, b1));
+    }
+    for (; p+16<=k; p+=16) {
+        __m256i a0 = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + p)));
+        __m256i b0 = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + p)));
+        acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(a0, b0));
+    }
+    sum = horizontal_sum(_mm256_add_epi32(acc0, acc1));
+#endif
+    for (; p<k; p++)
+        sum += a[p] * b[p];
+    return sum;
+}
+
+// Blocked c (n x m) = a (n x k) * transpose(b) (m x k), for every precision with a 4x2 tile kernel and a dot
+template <class T, class Sum>
+static void blocked_multiply(const T* a, const T* b, Sum* c, size_t n, size_t m, size_t k) {
+    std::fill(c, c + n*m, (Sum)0);
+
+    for (size_t p0=0; p0<k; p0+=BLOCK_DEPTH) {
+        size_t depth = std::min(BLOCK_DEPTH, k-p0);
+        for (size_t i0=0; i0<n; i0+=BLOCK_ROWS) {
+            size_t i1 = std::min(i0+BLOCK_ROWS, n);
+            for (size_t j0=0; j0<m; j0+=BLOCK_COLS) {
+                size_t j1 = std::min(j0+BLOCK_COLS, m);
+
+                // full 4x2 tiles
+                size_t i = i0;
+                for (; i+4<=i1; i+=4) {
+                    size_t j = j0;
+                    for (; j+2<=j1; j+=2)
+                        kernel_4x2(a + i*k + p0, k, b + j*k + p0, k, c + i*m + j, m, depth);
+                    for (; j<j1; j++)
+                        for (size_t r=i; r<i+4; r++)
+                            c[r*m + j] += dot(a + r*k + p0, b + j*k + p0, depth);
+                }
+                // leftover rows
+                for (; i<i1; i++)
+                    for (size_t j=j0; j<j1; j++)
+                        c[i*m + j] += dot(a + i*k + p0, b + j*k + p0, depth);
+            }
+        }
+    }
+}
+
+// Compute c (n x m) = a (n x k) * transpose(b) (m x k), all row-major
+void multiply_transposed(const double* a, const double* b, double* c, size_t n, size_t m, size_t k) {
+    blocked_multiply(a, b, c, n, m, k);
+}
+void multiply_transposed(const float* a, const float* b, float* c, size_t n, size_t m, size_t k) {
+    blocked_multiply(a, b, c, n, m, k);
+}
+void multiply_transposed(const int8_t* a, const int8_t* b, int32_t* c, size_t n, size_t m, size_t k) {
+    blocked_multiply(a, b, c, n, m, k);
+}
+
+// Keep the nonzero entries of a dense matrix
+SparseMatrix::SparseMatrix(const double* dense, size_t rowsIn, size_t colsIn) : rows(rowsIn), cols(colsIn) {
+    rowStart.reserve(rows+1);
+    rowStart.push_back(0);
+    for (size_t r=0; r<rows; r++) {
+        for (size_t c=0; c<cols; c++) {
+            if (dense[r*cols + c] == 0.0) continue;
+            columns.push_back(c);
+            values.push_back(dense[r*cols + c]);
+        }
+        rowStart.push_back(values.size());
+    }
+}
+// Dot product of one row with a dense vector, gathering only the columns it has
+double SparseMatrix::dot(size_t row, const double* x) const {
+    size_t p = rowStart[row], end = rowStart[row+1];
+    // two accumulators so consecutive entries don't wait on each other
+    double sum0 = 0.0, sum1 = 0.0;
+    for (; p+2<=end; p+=2) {
+        sum0 += values[p] * x[columns[p]];
+        sum1 += values[p+1] * x[columns[p+1]];
+    }
+    if (p < end) sum0 += values[p] * x[columns[p]];
+    return sum0 + sum1;
+}
+// Refresh the values from a dense matrix and zero whatever it has outside the pattern
+void SparseMatrix::mask(double* dense) {
+    for (size_t r=0; r<rows; r++) {
+        double* row = dense + r*cols;
+        size_t c = 0;
+        for (size_t p=rowStart[r]; p<rowStart[r+1]; p++) {
+            for (; c<columns[p]; c++) row[c] = 0.0;
+            values[p] = row[c++];
+        }
+        for (; c<cols; c++) row[c] = 0.0;
+    }
+}
+// Compute c = a * transpose(b) for a sparse b, a block of rows of a at a time
+// the block is transposed first so every entry of b scales a contiguous run of samples
+void multiply_transposed(const double* a, const SparseMatrix& b, double* c, size_t n) {
+    size_t k = b.cols, m = b.rows;
+    std::vector<double> transposed(k * std::min(n, BLOCK_ROWS));
+    double sums[BLOCK_ROWS];
+    for (size_t i0=0; i0<n; i0+=BLOCK_ROWS) {
+        size_t width = std::min(i0+BLOCK_ROWS, n) - i0;
+        for (size_t i=0; i<width; i++)
+            for (size_t p=0; p<k; p++)
+                transposed[p*width + i] = a[(i0+i)*k + p];
+
+        for (size_t j=0; j<m; j++) {
+            std::fill(sums, sums + width, 0.0);
+            for (size_t e=b.rowStart[j]; e<b.rowStart[j+1]; e++) {
+                const double* x = &transposed[b.columns[e]*width];
+                double value = b.values[e];
+                size_t i = 0;
+#ifdef __AVX2__
+                __m256d v = _mm256_set1_pd(value);
+                for (; i+4<=width; i+=4)
+                    _mm256_storeu_pd(sums + i, _mm256_fmadd_pd(v, _mm256_loadu_pd(x + i), _mm256_loadu_pd(sums + i)));
+#endif
+                for (; i<width; i++)
+                    sums[i] += value * x[i];
+            }
+            for (size_t i=0; i<width; i++)
+                c[(i0+i)*m + j] = sums[i];
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "aligned.h"
+
+// Dense row-major matrix of doubles, one sample per row when used as a batch
+struct Matrix {
+    public:
+        size_t rows;
+        size_t cols;
+        AlignedVector<double> data;
+
+        Matrix(size_t rowsIn=0, size_t colsIn=0)
+            : rows(rowsIn), cols(colsIn), data(rowsIn*colsIn) {}
+
+        void resize(size_t rowsIn, size_t colsIn) {rows = rowsIn; cols = colsIn; data.resize(rows*cols);}
+
+        double* operator[](size_t row) {return &data[row*cols];}
+        const double* operator[](size_t row) const {return &data[row*cols];}
+};
+
+// Compressed sparse row matrix holding the nonzero entries of a dense row-major one
+struct SparseMatrix {
+    public:
+        size_t rows = 0;
+        size_t cols = 0;
+        std::vector<size_t> rowStart; // entries of row r are [rowStart[r], rowStart[r+1])
+        std::vector<uint32_t> columns;
+        AlignedVector<double> values;
+
+        SparseMatrix() {}
+        SparseMatrix(const double* dense, size_t rowsIn, size_t colsIn); // keeps the nonzero entries
+
+        bool empty() const {return rows == 0;}
+        double density() const {return rows && cols ? (double)values.size() / (rows*cols) : 1.0;}
+        double dot(size_t row, const double* x) const; // one row against a dense vector of cols
+        // take the values of the entries back from a dense matrix of the same shape, zeroing the others in it
+        void mask(double* dense);
+};
+
+// Dot product of two vectors of length k
+double dot(const double* a, const double* b, size_t k);
+float dot(const float* a, const float* b, size_t k);
+int32_t dot(const int8_t* a, const int8_t* b, size_t k); // exact, k up to 2^17
+
+// Compute c (n x m) = a (n x k) * transpose(b) (m x k), all row-major
+void multiply_transposed(const double* a, const double* b, double* c, size_t n, size_t m, size_t k);
+void multiply_transposed(const float* a, const float* b, float* c, size_t n, size_t m, size_t k);
+void multiply_transposed(const int8_t* a, const int8_t* b, int32_t* c, size_t n, size_t m, size_t k); // exact, k up to 2^17
+// Compute c (n x b.rows) = a (n x b.cols) * transpose(b) for a sparse b
+void multiply_transposed(const double* a, const SparseMatrix& b, double* c, size_t n);
+
+#endif
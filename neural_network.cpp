@@ -1,167 +1,784 @@
 #include "config.h"
 #include "neural_network.h"
+#include "thread_pool.h"
+#include "checkpoint.h"
+#include "streaming_dataset.h"
+#include "evaluator.h"
+#include <stdexcept>
+#include <string>
+#include <limits>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 
-std::default_random_engine rng(RANDOM_SEED);
+// Flushes denormal floats to zero on the calling thread while in scope, float32 sigmoid outputs
+// near zero would otherwise send every multiply they reach down the slow microcoded path
+struct FlushDenormals {
+    public:
+#ifdef __SSE2__
+        unsigned int saved = _mm_getcsr();
+        FlushDenormals() {_mm_setcsr(saved | 0x8040);} // flush to zero and denormals are zero
+        ~FlushDenormals() {_mm_setcsr(saved);}
+#endif
+};
+
+// Instances gathered into each batch when evaluating a dataset view
+static const size_t EVAL_BLOCK = 1024;
+// Evaluation work is split into at most this many chunks of whole blocks
+static const size_t MAX_EVAL_CHUNKS = 64;
+
+// Gradient work is split into at most this many chunks of at least MIN_CHUNK_SIZE instances
+static const size_t MAX_GRADIENT_CHUNKS = 64;
+static const size_t MIN_CHUNK_SIZE = 16;
 
-// Constructor for Nodes
-Node::Node(const size_t& numAxon) {
-    weights.resize(numAxon);
-    randomize();
-}
 // Constructor for Layer
-Layer::Layer(const size_t& size, const size_t& prevLayerSize) {
-    nodes.resize(size, nullptr);
-    for (auto& node : nodes)
-        node = new Node(prevLayerSize);
+Layer::Layer(const size_t& size, const size_t& prevLayerSize, Activation activationIn) {
     numInputs = prevLayerSize;
+    activation = activationIn;
+
+    // biases start on their own cache line after the weights
+    size_t biasOffset = (size*numInputs + 7) / 8 * 8;
+    storage.resize(biasOffset + size);
+    view(storage.data(), storage.data() + biasOffset, size);
+}
+// Constructor for Layer viewing weights and biases stored elsewhere
+Layer::Layer(const size_t& size, const size_t& prevLayerSize, double* weightsIn, double* biasesIn,
+    Activation activationIn) {
+    numInputs = prevLayerSize;
+    activation = activationIn;
+    view(weightsIn, biasesIn, size);
+}
+// Copy parameters viewed elsewhere into the layer's own storage
+void Layer::own() {
+    size_t size = nodes.size();
+    size_t biasOffset = (size*numInputs + 7) / 8 * 8;
+    AlignedVector<double> copy(biasOffset + size);
+    std::copy(weights.begin(), weights.end(), copy.data());
+    std::copy(biases.begin(), biases.end(), copy.data() + biasOffset);
+    storage.swap(copy);
+    view(storage.data(), storage.data() + biasOffset, size);
+}
+// Point the parameters and nodes at the given storage
+void Layer::view(double* weightsIn, double* biasesIn, size_t size) {
+    weights = Parameters{weightsIn, size*numInputs};
+    biases = Parameters{biasesIn, size};
+
+    // each node views its own row of the weight matrix
+    nodes.clear();
+    for (size_t n=0; n<size; n++)
+        nodes.push_back(Node(&weights[n*numInputs], numInputs, &biases[n]));
 }
-// Constructor for NeuralNetwork
-NeuralNetwork::NeuralNetwork(const std::vector<size_t>& layerSizes) {
+// Optimizer settings from config.h
+static Optimizer config_optimizer() {
+    Optimizer optimizer;
+    optimizer.type = OPTIMIZER;
+    optimizer.momentum = MOMENTUM_DECAY;
+    optimizer.beta2 = ADAM_BETA2;
+    optimizer.weightDecay = WEIGHT_DECAY;
+    optimizer.schedule.type = LR_SCHEDULE;
+    optimizer.schedule.warmupSteps = LR_WARMUP;
+    optimizer.schedule.stepSize = LR_STEP_SIZE;
+    optimizer.schedule.decay = LR_STEP_DECAY;
+    optimizer.schedule.minFraction = LR_MIN_FRACTION;
+    return optimizer;
+}
+
+// Constructors for NeuralNetwork
+NeuralNetwork::NeuralNetwork() : optimizer(config_optimizer()) {}
+NeuralNetwork::NeuralNetwork(const std::vector<size_t>& layerSizes, const std::vector<Activation>& activations,
+    uint64_t run) : optimizer(config_optimizer()) {
+    if (!activations.empty() && activations.size() != layerSizes.size()-1)
+        throw std::invalid_argument("expected an activation for each of the " + std::to_string(layerSizes.size()-1) +
+            " layers after the input");
+
     layers.push_back(new Layer(layerSizes.front(), 0));
-    for (auto it = layerSizes.begin()+1; it != layerSizes.end(); it++)
-        layers.push_back(new Layer(*it, *(it-1)));
+    for (size_t l=1; l<layerSizes.size(); l++) {
+        Activation activation = l+1 < layerSizes.size() ? HIDDEN_ACTIVATION : OUTPUT_ACTIVATION;
+        if (!activations.empty()) activation = activations[l-1];
+        layers.push_back(new Layer(layerSizes[l], layerSizes[l-1], activation));
+    }
+    randomize(run);
 }
 
 // Calculate the loss of a single data point
-double NeuralNetwork::loss(DataInstance dataInstance) {
-    std::vector<double> output = calculate(dataInstance.features);
-    std::vector<double> expected_output(output.size(), 0.0);
-        expected_output[dataInstance.label] = 1.0;
-    
-    double loss = 0.0;
-    for (size_t i=0; i<output.size(); i++) {
-        loss += std::pow((output[i] - expected_output[i]), 2);}
-
-    return loss;
+double NeuralNetwork::loss(const double* features, int label) {
+    if (layers.back()->activation != SOFTMAX) {
+        std::vector<double> output = calculate(std::vector<double>(features, features + layers.front()->nodes.size()));
+        return squared_error(output.data(), label, output.size());
+    }
+    // cross-entropy from the weighted sums, the same kernel backpropagate uses
+    std::vector<double> input(features, features + layers.front()->nodes.size());
+    for (size_t l=1; l+1<layers.size(); l++) input = layers[l]->calculate(input);
+    std::vector<double> sums(layers.back()->nodes.size()), delta(sums.size());
+    layers.back()->weighted_sums(input.data(), sums.data());
+    return softmax_cross_entropy(sums.data(), label, delta.data(), sums.size());
+}
+// Instances of class c
+size_t Metrics::actual(size_t c) const {
+    size_t total = 0;
+    for (size_t p=0; p<numClasses; p++) total += confusion[c*numClasses + p];
+    return total;
+}
+// Instances predicted as class c
+size_t Metrics::predicted(size_t c) const {
+    size_t total = 0;
+    for (size_t a=0; a<numClasses; a++) total += confusion[a*numClasses + c];
+    return total;
 }
+double Metrics::precision(size_t c) const {
+    size_t total = predicted(c);
+    return total ? (double)confusion[c*numClasses + c] / total : 0.0;
+}
+double Metrics::recall(size_t c) const {
+    size_t total = actual(c);
+    return total ? (double)confusion[c*numClasses + c] / total : 0.0;
+}
+// Add the results of other instances
+void Metrics::merge(const Metrics& other) {
+    count += other.count;
+    correct += other.correct;
+    totalLoss += other.totalLoss;
+    for (size_t i=0; i<confusion.size() && i<other.confusion.size(); i++)
+        confusion[i] += other.confusion[i];
+}
+
 // Calculate the average loss of a dataset
-double NeuralNetwork::loss(std::vector<DataInstance> dataset) {
-    // reduce the dataset to generalize and optimize calculation of the loss
-    size_t reduced_size = std::min((int)(dataset.size()*0.3), 20);
-    std::shuffle(dataset.begin(), dataset.end(), std::default_random_engine(rng));
-    std::vector<DataInstance> reduced_set(dataset.begin(), dataset.begin()+reduced_size);
+double NeuralNetwork::loss(const DatasetView& dataset) {
+    return evaluate(dataset).loss();
+}
+// Loss, accuracy and confusion matrix of a dataset in one pass over it
+Metrics NeuralNetwork::evaluate(const DatasetView& dataset, Precision precision) {
+    size_t numClasses = layers.back()->nodes.size();
+    bool softmax = layers.back()->activation == SOFTMAX;
+    size_t numBlocks = (dataset.size() + EVAL_BLOCK-1) / EVAL_BLOCK;
 
-    // add the loss of each data point
-    double total_loss = 0.0;
-    for (auto& data : reduced_set)
-        total_loss += loss(data);
+    // every chunk of blocks accumulates on its own and the chunks merge in order,
+    // so the sums don't depend on how many threads the pool has
+    size_t numChunks = std::min(MAX_EVAL_CHUNKS, numBlocks);
+    std::vector<Metrics> chunks(numChunks, Metrics(numClasses));
+    thread_pool().parallel_for(numChunks, [&](size_t c) {
+        Metrics& metrics = chunks[c];
+        Matrix batch;
+        std::vector<double> delta(numClasses);
+        for (size_t block=c*numBlocks/numChunks; block<(c+1)*numBlocks/numChunks; block++) {
+            size_t begin = block*EVAL_BLOCK, end = std::min(begin+EVAL_BLOCK, dataset.size());
+            dataset.gather(begin, end, batch);
+            // softmax outputs come back as weighted sums, the fused cross-entropy turns them into probabilities
+            Matrix output = calculate_batch(batch, precision, !softmax);
+
+            // loss, prediction and confusion cell of every instance while its outputs are in cache
+            for (size_t i=0; i<output.rows; i++) {
+                double* row = output[i];
+                size_t label = dataset.label(begin+i);
+                metrics.totalLoss += softmax ? softmax_cross_entropy(row, label, delta.data(), numClasses) :
+                    squared_error(row, label, numClasses);
+
+                // the maximum node is considered to be the predicted class
+                size_t predicted = std::distance(row, std::max_element(row, row + numClasses));
+                metrics.correct += predicted == label;
+                if (label < numClasses) metrics.confusion[label*numClasses + predicted]++;
+                metrics.count++;
+            }
+        }
+    });
 
-    return total_loss / reduced_size;
+    Metrics total(numClasses);
+    for (auto& chunk : chunks) total.merge(chunk);
+    return total;
 }
 
-// Updates the weights and biases
-void NeuralNetwork::apply_gradient(std::vector<std::vector<std::vector<double>>>& weights, std::vector<std::vector<double>>& biases) {
-    for (size_t l=0; l<layers.size(); l++) {
+
+// Updates the weights and biases with the optimizer, at the scheduled rate
+void NeuralNetwork::apply_gradient(Gradient& gradient, double learnRate) {
+    double rate = optimizer.schedule.rate(learnRate, optimizer.steps, optimizer.totalSteps);
+    optimizer.steps++;
+
+    for (size_t l=1; l<layers.size(); l++) {
+        Layer* layer = layers[l];
+        size_t numWeights = layer->weights.size();
+        size_t numParameters = numWeights + layer->biases.size();
+
+        // state starts at zero, beside the parameters it belongs to
+        if (optimizer.has_velocity() && layer->velocity.size() != numParameters) layer->velocity.assign(numParameters, 0.0);
+        if (optimizer.has_squares() && layer->squares.size() != numParameters) layer->squares.assign(numParameters, 0.0);
+        double* velocity = optimizer.has_velocity() ? layer->velocity.data() : nullptr;
+        double* squares = optimizer.has_squares() ? layer->squares.data() : nullptr;
+
+        optimizer.update(layer->weights.data(), gradient.weights[l].data(), velocity, squares, numWeights, rate, true);
+        optimizer.update(layer->biases.data(), gradient.biases[l].data(),
+            velocity ? velocity + numWeights : nullptr, squares ? squares + numWeights : nullptr,
+            layer->biases.size(), rate, false);
+
+        // pruned weights stay pruned
+        if (!layer->sparse.empty()) layer->sparse.mask(layer->weights.data());
+    }
+}
+// Start a new run of the optimizer
+void NeuralNetwork::reset_optimizer(size_t totalSteps) {
+    optimizer.steps = 0;
+    optimizer.totalSteps = totalSteps;
+    for (auto layer : layers) {
+        layer->velocity.clear();
+        layer->squares.clear();
+    }
+}
+// Accumulate the loss gradients of a single data point using backpropagation
+void NeuralNetwork::backpropagate(const double* features, int label, Gradient& gradient, Workspace& workspace) {
+    // forward pass, keeping the output of every layer
+    std::vector<std::vector<double>>& activations = workspace.activations;
+    activations[0].assign(features, features + layers.front()->nodes.size());
+    for (size_t l=1; l+1<layers.size(); l++)
+        layers[l]->calculate(activations[l-1].data(), activations[l].data());
+
+    // error of the output layer
+    Layer* output_layer = layers.back();
+    std::vector<double>& output = activations.back();
+    std::vector<double>& delta = workspace.delta;
+    delta.resize(output.size());
+    if (output_layer->activation == SOFTMAX) {
+        // cross-entropy straight from the weighted sums, its gradient skips the softmax derivative
+        output_layer->weighted_sums(activations[layers.size()-2].data(), output.data());
+        softmax_cross_entropy(output.data(), label, delta.data(), delta.size());
+    } else {
+        // squared error
+        output_layer->calculate(activations[layers.size()-2].data(), output.data());
+        for (size_t n=0; n<output.size(); n++)
+            delta[n] = 2 * output[n];
+        if ((size_t)label < delta.size()) delta[label] -= 2.0;
+        activation_backward(output_layer->activation, output.data(), delta.data(), delta.size());
+    }
+
+    // propagate the error backwards through the layers
+    for (size_t l=layers.size()-1; l>0; l--) {
         Layer* layer = layers[l];
+        const double* input = activations[l-1].data();
+        std::vector<double>& prev_delta = workspace.prev_delta;
+        prev_delta.assign(layer->numInputs, 0.0);
+
         for (size_t n=0; n<layer->nodes.size(); n++) {
-            Node* node = layer->nodes[n];
-            for (size_t w=0; w<node->weights.size(); w++) {
-                node->weights[w] -= weights[l][n][w];
+            const double* weights = &layer->weights[n*layer->numInputs];
+            double* weight_gradient = &gradient.weights[l][n*layer->numInputs];
+            for (size_t w=0; w<layer->numInputs; w++) {
+                weight_gradient[w] += delta[n] * input[w];
+                prev_delta[w] += delta[n] * weights[w];
             }
-            node->bias -= biases[l][n];
+            gradient.biases[l][n] += delta[n];
         }
+
+        // the input layer has no parameters to pass the error on to
+        if (l > 1)
+            activation_backward(layers[l-1]->activation, input, prev_delta.data(), prev_delta.size());
+        delta.swap(prev_delta);
     }
 }
-// Nudge the weights and biases toward the right direction
-void NeuralNetwork::learn(std::vector<DataInstance> dataset, double learnRate) {
-    double original_loss = loss(dataset);
-    double nudge = 0.0001;
+// Size a gradient like the network and zero it
+void NeuralNetwork::zero_gradient(Gradient& gradient) {
+    gradient.weights.resize(layers.size());
+    gradient.biases.resize(layers.size());
+    for (size_t l=0; l<layers.size(); l++) {
+        gradient.weights[l].assign(layers[l]->weights.size(), 0.0);
+        gradient.biases[l].assign(layers[l]->biases.size(), 0.0);
+    }
+}
+// Calculate the average loss gradients of a dataset
+void NeuralNetwork::gradient(const DatasetView& dataset, Gradient& gradient) {
+    // split the dataset into a fixed number of chunks so the summation order
+    // does not depend on how many threads the pool has
+    size_t numChunks = std::min(MAX_GRADIENT_CHUNKS, (dataset.size()+MIN_CHUNK_SIZE-1) / MIN_CHUNK_SIZE);
+    numChunks = std::max(numChunks, (size_t)1);
+    size_t chunkSize = (dataset.size()+numChunks-1) / numChunks;
+    chunk_gradients.resize(numChunks);
+    chunk_workspaces.resize(numChunks);
 
-    // Used for 
-    std::vector<std::vector<std::vector<double>>> loss_gradient_weights;
-    std::vector<std::vector<double>> loss_gradient_bias;
+    // each chunk accumulates into its own buffer
+    thread_pool().parallel_for(numChunks, [this, &dataset, chunkSize](size_t c) {
+        Gradient& chunk_gradient = chunk_gradients[c];
+        zero_gradient(chunk_gradient);
 
-    // Find the loss gradients for weights and biases
-    for (auto& layer : layers) {
-        std::vector<std::vector<double>> layer_weight_gradient;
-        std::vector<double> layer_bias_gradient;
-        for (auto& node : layer->nodes) {
-            std::vector<double> node_weight_gradient;
-            for (auto& weight : node->weights) {
-                weight += nudge;
-                node_weight_gradient.push_back(learnRate * ((loss(dataset)-original_loss)/nudge));
-                weight -= nudge;
+        Workspace& workspace = chunk_workspaces[c];
+        workspace.activations.resize(layers.size());
+        for (size_t l=0; l<layers.size(); l++)
+            workspace.activations[l].resize(layers[l]->nodes.size());
+
+        size_t end = std::min(dataset.size(), (c+1)*chunkSize);
+        for (size_t i=c*chunkSize; i<end; i++)
+            backpropagate(dataset.features(i), dataset.label(i), chunk_gradient, workspace);
+    });
+
+    // pairwise tree reduction of the chunk buffers in a fixed order
+    for (size_t stride=1; stride<numChunks; stride*=2) {
+        size_t numPairs = (numChunks + 2*stride - 1) / (2*stride);
+        thread_pool().parallel_for(numPairs, [this, stride, numChunks](size_t p) {
+            size_t left = p*2*stride, right = left+stride;
+            if (right >= numChunks) return;
+            for (size_t l=0; l<layers.size(); l++) {
+                std::vector<double>& weights = chunk_gradients[left].weights[l];
+                const std::vector<double>& other_weights = chunk_gradients[right].weights[l];
+                for (size_t w=0; w<weights.size(); w++) weights[w] += other_weights[w];
+                std::vector<double>& biases = chunk_gradients[left].biases[l];
+                const std::vector<double>& other_biases = chunk_gradients[right].biases[l];
+                for (size_t n=0; n<biases.size(); n++) biases[n] += other_biases[n];
             }
-            layer_weight_gradient.push_back(node_weight_gradient);
+        });
+    }
 
-            node->bias += nudge;
-            layer_bias_gradient.push_back(learnRate * ((loss(dataset)-original_loss)/nudge));
-            node->bias -= nudge;
+    std::swap(gradient, chunk_gradients[0]);
+    for (size_t l=0; l<layers.size(); l++) {
+        for (auto& weight : gradient.weights[l])
+            weight /= dataset.size();
+        for (auto& bias : gradient.biases[l])
+            bias /= dataset.size();
+    }
+}
+// Nudge the weights and biases toward the right direction
+void NeuralNetwork::learn(const DatasetView& dataset, double learnRate) {
+    Gradient& loss_gradient = step_gradient;
 
-        }
-        loss_gradient_weights.push_back(layer_weight_gradient);
-        loss_gradient_bias.push_back(layer_bias_gradient);
+    // Find the loss gradients for weights and biases
+    {
+        Telemetry::Scope scope(telemetry, Telemetry::GRADIENT);
+        gradient(dataset, loss_gradient);
     }
 
     // Apply the loss gradients
-    apply_gradient(loss_gradient_weights, loss_gradient_bias);
+    Telemetry::Scope scope(telemetry, Telemetry::APPLY_GRADIENT);
+    apply_gradient(loss_gradient, learnRate);
 }
+// Compare the backpropagation gradients against finite differences of the loss
+double NeuralNetwork::gradient_check(const DatasetView& dataset) {
+    double nudge = 0.0001;
+    double max_deviation = 0.0;
+
+    // the check nudges the dense weights, so the sparse copies step aside until it is done
+    std::vector<SparseMatrix> sparse(layers.size());
+    for (size_t l=1; l<layers.size(); l++)
+        std::swap(sparse[l], layers[l]->sparse);
+
+    Gradient loss_gradient;
+    gradient(dataset, loss_gradient);
+
+    // exact average loss over the whole dataset
+    auto average_loss = [this, &dataset]() {
+        double total_loss = 0.0;
+        for (size_t i=0; i<dataset.size(); i++)
+            total_loss += loss(dataset.features(i), dataset.label(i));
+        return total_loss / dataset.size();
+    };
+    // central difference of the loss around a single parameter
+    auto numerical_gradient = [&average_loss, nudge](double& parameter) {
+        double original = parameter;
+        parameter = original + nudge;
+        double loss_plus = average_loss();
+        parameter = original - nudge;
+        double loss_minus = average_loss();
+        parameter = original;
+        return (loss_plus - loss_minus) / (2 * nudge);
+    };
+
+    for (size_t l=1; l<layers.size(); l++) {
+        Layer* layer = layers[l];
+        for (size_t w=0; w<layer->weights.size(); w++)
+            max_deviation = std::max(max_deviation,
+                std::abs(numerical_gradient(layer->weights[w]) - loss_gradient.weights[l][w]));
+        for (size_t n=0; n<layer->biases.size(); n++)
+            max_deviation = std::max(max_deviation,
+                std::abs(numerical_gradient(layer->biases[n]) - loss_gradient.biases[l][n]));
+    }
+
+    for (size_t l=1; l<layers.size(); l++)
+        std::swap(sparse[l], layers[l]->sparse);
+    return max_deviation;
+}
+
+// Trains using a training set, choosing the weights to keep with a validation set
+// evaluations run on snapshots of the weights while the following epochs train, see EVAL_INTERVAL
+void NeuralNetwork::train(const DatasetView& trainset, const DatasetView& validation, size_t max_iteration, double learn_rate,
+    const std::string& checkpoint) {
+    if (telemetry) telemetry->begin_run();
+    reset_optimizer(max_iteration);
+    normalization = trainset.data->normalization; // the weights will expect features scaled like these
+
+    // without validation rows the training rows have to stand in for them
+    AsyncEvaluator evaluator(trainset, validation.size() ? validation : trainset, ASYNC_EVAL);
+    Evaluation latest = {}, best = {};
+    size_t stale = 0; // evaluations since the best one
+    std::shared_ptr<NeuralNetwork> stop_at; // snapshot to finish with once training stops early
+
+    // report an evaluation and decide whether to stop on it
+    auto handle = [&](const Evaluation& result) {
+        if (!quiet) printf("%ld: [loss:%f] [validation loss:%f] [validation accuracy:%f]\n",
+            result.epoch, result.loss, result.validationLoss, result.accuracy);
+        if (telemetry) telemetry->evaluated(result.start, result.lossEnd, result.end);
+        latest = result;
+
+        // the validation loss still moves when a small validation set's accuracy doesn't
+        if (!best.network || result.validationLoss < best.validationLoss) {
+            best = result;
+            stale = 0;
+        } else {
+            stale++;
+        }
+        latest.network.reset();
+
+        // consider a high accuracy or low loss to be converged
+        if (!stop_at && (result.loss < 0.1 || result.accuracy == 1.0))
+            stop_at = result.network;
+        else if (!stop_at && EARLY_STOP_PATIENCE && stale >= EARLY_STOP_PATIENCE)
+            stop_at = best.network;
+    };
+
+    Evaluation result;
+    for (size_t i=1; i<=max_iteration && !stop_at; i++) {
+        if (telemetry) telemetry->begin_epoch();
 
-// Trains using a training set and test with a testing set
-void NeuralNetwork::train(std::vector<DataInstance> trainset, std::vector<DataInstance> testset, size_t max_iteration, double learn_rate) {
-    for (size_t i=1; i<=max_iteration; i++) {
         // nudge the model towards a "minima"
         learn(trainset, learn_rate);
 
-        // calculate the loss and accuracy and print it
-        double iteration_loss = loss(trainset);
-        double iteration_accuracy = test(testset);
-        printf("%ld: [loss:%f] [accuracy:%f]\n", i, iteration_loss, iteration_accuracy);
+        // hand the weights over for evaluation and report whatever has finished
+        if (i % EVAL_INTERVAL == 0 || i == max_iteration)
+            evaluator.submit(*this, i);
+        while (evaluator.poll(result)) handle(result);
+        if (telemetry) telemetry->end_epoch(i, trainset.size(), latest.loss, latest.accuracy, latest.epoch);
 
-        // consider a high accuracy or low loss to be converged
-        if (iteration_loss < 0.1 || iteration_accuracy == 1.0)
-            break;
+        // periodically save the progress
+        if (!checkpoint.empty() && i % CHECKPOINT_INTERVAL == 0 && i != max_iteration)
+            save_checkpoint(*this, checkpoint);
     }
+
+    // report the evaluations still running, then go back to the weights that stopped training
+    evaluator.finish();
+    while (evaluator.poll(result)) handle(result);
+    if (stop_at) copy_parameters(*stop_at);
+
+    // always save at the end
+    if (!checkpoint.empty())
+        save_checkpoint(*this, checkpoint);
 }
-// Tests the model using a testing set and get its accuracy
-double NeuralNetwork::test(std::vector<DataInstance> testset) {
-    size_t correct = 0; // track the correct predictions
+// Trains on a streamed dataset, evaluating on its test partition after every epoch
+void NeuralNetwork::train(StreamingDataset& stream, size_t epochs, size_t batch_size, double learn_rate,
+    const std::string& checkpoint) {
+    Dataset batch;
+    if (telemetry) telemetry->begin_run();
+    normalization = Normalization(); // streamed features arrive unscaled
+    size_t batches_per_epoch = (stream.expected_rows(StreamingDataset::TRAIN) + batch_size - 1) / batch_size;
+    reset_optimizer(batches_per_epoch * epochs);
+    for (size_t epoch=1; epoch<=epochs; epoch++) {
+        if (telemetry) telemetry->begin_epoch();
 
-    for (auto data : testset) {
-        // get the predictions
-        std::vector<double> output = calculate(data.features);
+        // one learning step per shuffled batch of the training partition
+        double epoch_loss = 0.0;
+        size_t numBatches = 0, numSamples = 0;
+        stream.begin(StreamingDataset::TRAIN, epoch);
+        while (stream.next(batch, batch_size)) {
+            learn(batch, learn_rate);
+            Telemetry::Scope scope(telemetry, Telemetry::LOSS);
+            epoch_loss += loss(batch);
+            numBatches++;
+            numSamples += batch.size();
+        }
 
-        // the maximum node is considered to be the predicted class
-        auto maxItr = std::max_element(output.begin(), output.end());
-        int maxIdx = std::distance(output.begin(), maxItr);
+        // accuracy over the whole test partition
+        Metrics test_metrics(layers.back()->nodes.size());
+        stream.begin(StreamingDataset::TEST, epoch);
+        while (stream.next(batch, batch_size)) {
+            Telemetry::Scope scope(telemetry, Telemetry::TEST);
+            test_metrics.merge(evaluate(batch));
+        }
 
-        // compare the predicted class and real class
-        if (maxIdx == data.label) correct++;
-    }
+        double epoch_loss_mean = numBatches ? epoch_loss / numBatches : 0.0;
+        double epoch_accuracy = test_metrics.accuracy();
+        printf("%ld: [loss:%f] [accuracy:%f]\n", epoch, epoch_loss_mean, epoch_accuracy);
+        if (telemetry) telemetry->end_epoch(epoch, numSamples, epoch_loss_mean, epoch_accuracy, epoch);
 
-    // return the accuracy as a percent
-    return (double)correct / (double)testset.size();
+        if (!checkpoint.empty() && (epoch % CHECKPOINT_INTERVAL == 0 || epoch == epochs))
+            save_checkpoint(*this, checkpoint);
+    }
+}
+// Tests the model using a testing set and get its accuracy
+double NeuralNetwork::test(const DatasetView& testset, Precision precision) {
+    return evaluate(testset, precision).accuracy();
 }
 
 // Claculate the output of a single layer given an input
-std::vector<double> Layer::calculate(std::vector<double> input) {
-    std::vector<double> output;
-    for (size_t i=0; i<nodes.size(); i++) {
-        double weighted_output = nodes[i]->bias;
+void Layer::calculate(const double* input, double* output) {
+    weighted_sums(input, output);
+    activate(activation, output, biases.size());
+}
+// Calculate the weighted sums of a single layer, before the activation
+void Layer::weighted_sums(const double* input, double* output) {
+    if (use_sparse()) {
+        for (size_t i=0; i<biases.size(); i++)
+            output[i] = biases[i] + sparse.dot(i, input);
+        return;
+    }
+    const double* row = weights.data();
+    for (size_t i=0; i<biases.size(); i++, row+=numInputs)
+        output[i] = biases[i] + dot(row, input, numInputs);
+}
+std::vector<double> Layer::calculate(const std::vector<double>& input) {
+    std::vector<double> output(biases.size());
+    calculate(input.data(), output.data());
+    return output;
+}
+// Calculate the outputs of a single layer for a batch of inputs
+void Layer::calculate_batch(const Matrix& input, Matrix& output, bool activated) {
+    if (input.cols != numInputs)
+        throw std::invalid_argument("expected " + std::to_string(numInputs) + " inputs, got " + std::to_string(input.cols));
+    output.resize(input.rows, biases.size());
+    if (use_sparse(true))
+        multiply_transposed(input.data.data(), sparse, output.data.data(), input.rows);
+    else
+        multiply_transposed(input.data.data(), weights.data(), output.data.data(),
+            input.rows, biases.size(), numInputs);
 
-        Node* node = nodes[i];
-        std::vector<double> weights = node->weights;
-        
-        for (size_t j=0; j<numInputs; j++)
-            weighted_output += weights[j] * input[j];
+    // bias pass, then the activation over the whole batch at once
+    for (size_t r=0; r<output.rows; r++) {
+        double* row = output[r];
+        for (size_t i=0; i<output.cols; i++)
+            row[i] += biases[i];
+    }
+    if (activated) activate(activation, output.data.data(), output.cols, output.rows);
+}
+// Claculate the output of a single layer in float32
+void Layer::calculate(const float* input, float* output) {
+    const float* row = weights32.data();
+    for (size_t i=0; i<biases32.size(); i++, row+=numInputs)
+        output[i] = biases32[i] + dot(row, input, numInputs);
+    activate(activation, output, biases32.size());
+}
+// Claculate the output of a single layer from int8 inputs and weights, accumulating in int32
+void Layer::calculate(const int8_t* input, float* output) {
+    const int8_t* row = weights8.data();
+    float scale = weightScale * inputScale;
+    for (size_t i=0; i<biases32.size(); i++, row+=stride8)
+        output[i] = biases32[i] + scale * dot(row, input, stride8);
+    activate(activation, output, biases32.size());
+}
+// Calculate the outputs of a single layer in float32 for rows of inputs
+void Layer::calculate_batch(const float* input, float* output, size_t rows, bool activated) {
+    multiply_transposed(input, weights32.data(), output, rows, biases32.size(), numInputs);
+    for (size_t r=0; r<rows; r++)
+        for (size_t i=0; i<biases32.size(); i++)
+            output[r*biases32.size() + i] += biases32[i];
+    if (activated) activate(activation, output, biases32.size(), rows);
+}
+// Calculate the outputs of a single layer from rows of int8 inputs, sums is scratch space for the int32 products
+void Layer::calculate_batch(const int8_t* input, float* output, size_t rows, AlignedVector<int32_t>& sums,
+    bool activated) {
+    size_t numNodes = biases32.size();
+    sums.resize(rows * numNodes);
+    multiply_transposed(input, weights8.data(), sums.data(), rows, numNodes, stride8);
+    float scale = weightScale * inputScale;
+    for (size_t r=0; r<rows; r++)
+        for (size_t i=0; i<numNodes; i++)
+            output[r*numNodes + i] = biases32[i] + scale * sums[r*numNodes + i];
+    if (activated) activate(activation, output, numNodes, rows);
+}
+// Make the float32 copy and the int8 copy with one scale for the whole layer
+void Layer::quantize(double inputMax) {
+    weights32.assign(weights.begin(), weights.end());
+    biases32.assign(biases.begin(), biases.end());
+
+    double weightMax = 0.0;
+    for (double w : weights) weightMax = std::max(weightMax, std::abs(w));
+    weightScale = weightMax > 0.0 ? weightMax / 127 : 1.0f;
+    inputScale = inputMax > 0.0 ? inputMax / 127 : 1.0f;
 
-        output.push_back(sigmoid(weighted_output));
+    // rows padded with zero weights, so the kernels never fall back to a scalar tail
+    stride8 = (numInputs + 15) / 16 * 16;
+    weights8.assign(nodes.size() * stride8, 0);
+    for (size_t n=0; n<nodes.size(); n++)
+        for (size_t w=0; w<numInputs; w++)
+            weights8[n*stride8 + w] = std::lround(weights[n*numInputs + w] / weightScale);
+}
+// Prune the weights below threshold
+void Layer::prune(double threshold) {
+    for (auto& weight : weights)
+        if (std::abs(weight) < threshold) weight = 0.0;
+    sparsify();
+}
+// Magnitude of the weight the given fraction of the layer's weights fall below
+double Layer::sparsity_threshold(double sparsity) const {
+    std::vector<double> magnitudes(weights.size());
+    for (size_t w=0; w<weights.size(); w++) magnitudes[w] = std::abs(weights[w]);
+    size_t count = std::min(magnitudes.size(), (size_t)std::llround(std::max(sparsity, 0.0) * magnitudes.size()));
+    if (count == magnitudes.size()) return std::numeric_limits<double>::infinity();
+    std::nth_element(magnitudes.begin(), magnitudes.begin() + count, magnitudes.end());
+    return magnitudes[count];
+}
+// Sparse layout of the nonzero weights
+void Layer::sparsify() {
+    sparse = SparseMatrix(weights.data(), nodes.size(), numInputs);
+    if (sparse.density() == 1.0) sparse = SparseMatrix();
+}
+// The sparse kernels pay an index load per weight, so they only win once enough weights are gone
+// a batch spreads that load over all of its rows and wins much sooner
+bool Layer::use_sparse(bool batch) const {
+    return !sparse.empty() && sparse.density() < (batch ? SPARSE_BATCH_DENSITY : SPARSE_DENSITY);
+}
+
+// Round rows of cols inputs onto the int8 grid of a layer, saturating values beyond the calibrated range
+// output rows are stride long with zeros after the inputs
+static void quantize_rows(const float* input, size_t rows, size_t cols, int8_t* output, size_t stride, float scale) {
+    float inverse = 1.0f / scale;
+    for (size_t r=0; r<rows; r++) {
+        const float* in = input + r*cols;
+        int8_t* out = output + r*stride;
+        for (size_t i=0; i<cols; i++)
+            out[i] = (int8_t)std::clamp(std::nearbyint(in[i] * inverse), -127.0f, 127.0f); // stays in floats, so it vectorizes
+        std::fill(out + cols, out + stride, 0);
     }
+}
+
+// Calculate the outputs of the neural network for a batch of inputs
+Matrix NeuralNetwork::calculate_batch(const Matrix& input) {
+    return calculate_batch(input, FLOAT64);
+}
+// Calculate the outputs for a batch of inputs at the given precision
+Matrix NeuralNetwork::calculate_batch(const Matrix& input, Precision precision, bool activated) {
+    if (precision == FLOAT64) {
+        Matrix current = layers.size() > 1 ? Matrix() : input, next;
+        const Matrix* layer_input = &input;
+        for (auto it = layers.begin()+1; it != layers.end(); it++) {
+            (*it)->calculate_batch(*layer_input, next, activated || it+1 != layers.end());
+            std::swap(current, next);
+            layer_input = &current;
+        }
+        return current;
+    }
+    for (auto it = layers.begin()+1; it != layers.end(); it++)
+        if ((*it)->weights32.size() != (*it)->weights.size())
+            throw std::logic_error("the network has to be quantized before reduced precision inference");
+    if (input.cols != layers.front()->nodes.size())
+        throw std::invalid_argument("expected " + std::to_string(layers.front()->nodes.size()) +
+            " inputs, got " + std::to_string(input.cols));
+
+    FlushDenormals flush;
+
+    // the whole batch goes through one layer at a time, like the float64 path
+    AlignedVector<float> current(input.data.begin(), input.data.end()), next;
+    AlignedVector<int8_t> quantized;
+    AlignedVector<int32_t> sums;
+    for (auto it = layers.begin()+1; it != layers.end(); it++) {
+        next.resize(input.rows * (*it)->nodes.size());
+        if (precision == INT8) {
+            quantized.resize(input.rows * (*it)->stride8);
+            quantize_rows(current.data(), input.rows, (*it)->numInputs, quantized.data(), (*it)->stride8, (*it)->inputScale);
+            (*it)->calculate_batch(quantized.data(), next.data(), input.rows, sums, activated || it+1 != layers.end());
+        } else {
+            (*it)->calculate_batch(current.data(), next.data(), input.rows, activated || it+1 != layers.end());
+        }
+        std::swap(current, next);
+    }
+    Matrix output(input.rows, layers.back()->nodes.size());
+    std::copy(current.begin(), current.end(), output.data.begin());
     return output;
 }
+// Make the reduced precision copies, the int8 input scales cover every activation of the calibration set
+void NeuralNetwork::quantize(const DatasetView& calibration) {
+    std::vector<double> inputMax(layers.size(), 0.0);
+    Matrix batch, next;
+    for (size_t begin=0; begin<calibration.size(); begin+=EVAL_BLOCK) {
+        size_t end = std::min(begin+EVAL_BLOCK, calibration.size());
+        calibration.gather(begin, end, batch);
+        for (size_t l=1; l<layers.size(); l++) {
+            for (double x : batch.data) inputMax[l] = std::max(inputMax[l], std::abs(x));
+            layers[l]->calculate_batch(batch, next);
+            std::swap(batch, next);
+        }
+    }
+    for (size_t l=1; l<layers.size(); l++)
+        layers[l]->quantize(inputMax[l]);
+}
+// Prune every layer by one threshold
+void NeuralNetwork::prune(double threshold) {
+    for (size_t l=1; l<layers.size(); l++) layers[l]->prune(threshold);
+}
+// Prune the same fraction of every layer, so the narrow output layer isn't wiped out by the wide ones
+void NeuralNetwork::prune_sparsity(double sparsity) {
+    for (size_t l=1; l<layers.size(); l++) layers[l]->prune(layers[l]->sparsity_threshold(sparsity));
+}
+void NeuralNetwork::sparsify() {
+    for (size_t l=1; l<layers.size(); l++) layers[l]->sparsify();
+}
+double NeuralNetwork::density() const {
+    size_t total = 0, kept = 0;
+    for (size_t l=1; l<layers.size(); l++) {
+        total += layers[l]->weights.size();
+        kept += layers[l]->sparse.empty() ? layers[l]->weights.size() : layers[l]->sparse.values.size();
+    }
+    return total ? (double)kept / total : 1.0;
+}
 // Calculate the output of the neural network
-std::vector<double> NeuralNetwork::calculate(std::vector<double> input) {
-    for (auto it = layers.begin()+1; it != layers.end(); it++)
-        input = (*it)->calculate(input);
-    return input;
+std::vector<double> NeuralNetwork::calculate(const std::vector<double>& input) {
+    // ping-pong between two buffers wide enough for any layer
+    size_t width = 0;
+    for (auto layer : layers) width = std::max(width, layer->nodes.size());
+    std::vector<double> buffer(2*width);
+    double* current = buffer.data();
+    double* next = buffer.data() + width;
+
+    std::copy(input.begin(), input.end(), current);
+    for (auto it = layers.begin()+1; it != layers.end(); it++) {
+        (*it)->calculate(current, next);
+        std::swap(current, next);
+    }
+    return std::vector<double>(current, current + layers.back()->nodes.size());
 }
 
+// Randomize the layer, keeping the weighted sums of the newer activations out of their flat regions
+void Layer::randomize(const RandomStream& random) {
+    sparse = SparseMatrix();
+    double limit = 2.0;
+    if (activation == RELU && numInputs)
+        limit = std::sqrt(6.0 / numInputs); // He
+    else if (activation != SIGMOID && numInputs)
+        limit = std::sqrt(6.0 / (numInputs + nodes.size())); // Glorot
+
+    // every node draws from a stream of its own, so the weights don't depend on the thread count
+    thread_pool().parallel_for(nodes.size(), [&](size_t n) {
+        RandomStream node_stream = random.child(n);
+        nodes[n].randomize(limit, node_stream);
+    });
+}
+// Randomize every layer from the weight init stream of a run
+void NeuralNetwork::randomize(uint64_t run) {
+    RandomStream random = random_stream(WEIGHT_INIT, run);
+    for (size_t l=0; l<layers.size(); l++)
+        layers[l]->randomize(random.child(l));
+}
 // Node randomize weights and biases
-void Node::randomize() {
-    std::uniform_real_distribution<double> distribution(-2.0, 2.0);
-    for (auto& weight : weights)
-        weight = distribution(rng);
-    bias = 0.0;
+void Node::randomize(double limit, RandomStream& random) {
+    for (size_t w=0; w<numAxon; w++)
+        weights[w] = random.uniform(-limit, limit);
+    *bias = 0.0;
+}
+
+// Copy of the layers and their parameters in its own storage, without the optimizer state
+NeuralNetwork* NeuralNetwork::clone() const {
+    NeuralNetwork* copy = new NeuralNetwork();
+    for (auto layer : layers) {
+        copy->layers.push_back(new Layer(layer->nodes.size(), layer->numInputs,
+            layer->weights.data(), layer->biases.data(), layer->activation));
+        copy->layers.back()->own();
+        copy->layers.back()->sparse = layer->sparse;
+    }
+    copy->optimizer = optimizer;
+    copy->normalization = normalization;
+    return copy;
+}
+// Take the parameters of a network with the same layer sizes
+void NeuralNetwork::copy_parameters(const NeuralNetwork& other) {
+    if (other.layers.size() != layers.size())
+        throw std::invalid_argument("expected a network with " + std::to_string(layers.size()) + " layers");
+    for (size_t l=0; l<layers.size(); l++) {
+        if (other.layers[l]->weights.size() != layers[l]->weights.size() ||
+            other.layers[l]->biases.size() != layers[l]->biases.size())
+            throw std::invalid_argument("layer " + std::to_string(l) + " differs in size");
+        std::copy(other.layers[l]->weights.begin(), other.layers[l]->weights.end(), layers[l]->weights.begin());
+        std::copy(other.layers[l]->biases.begin(), other.layers[l]->biases.end(), layers[l]->biases.begin());
+        if (!layers[l]->sparse.empty()) layers[l]->sparse.mask(layers[l]->weights.data());
+    }
 }
 
 // Display neural network
@@ -175,14 +792,14 @@ void NeuralNetwork::show() {
 void Layer::show() {
     printf(" Layer {\n");
     for (auto it=nodes.begin(); it!=nodes.end(); it++)
-        (*it)->show();
+        it->show();
     printf(" }\n");
 }
 // Display node information
 void Node::show() {
     printf("  Node {\n");
-    printf("   weights:\t\n"); for (auto weight: weights) printf("    %f\n", weight);
-    printf("   bias: %f\n", bias);
+    printf("   weights:\t\n"); for (size_t w=0; w<numAxon; w++) printf("    %f\n", weights[w]);
+    printf("   bias: %f\n", *bias);
     printf("  }\n");
 }
 
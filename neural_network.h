@@ -4,7 +4,16 @@
 #include <vector>
 #include <cmath>
 #include <algorithm>
-#include <random>
+#include <memory>
+#include <string>
+#include "aligned.h"
+#include "matrix.h"
+#include "dataset.h"
+#include "mapped_file.h"
+#include "telemetry.h"
+#include "activation.h"
+#include "optimizer.h"
+#include "rng.h"
 
 // A datapoint for a dataset that contains features associated with a class
 struct DataInstance {
@@ -13,61 +22,217 @@ struct DataInstance {
         int label;
 };
 
-// Node class that affect the output the network
+struct StreamingDataset;
+
+// Loss gradients laid out like the weights and biases of each layer
+struct Gradient {
+    public:
+        std::vector<std::vector<double>> weights;
+        std::vector<std::vector<double>> biases;
+};
+
+// View of a block of parameters, owned by a layer or by a mapped checkpoint
+struct Parameters {
+    public:
+        double* ptr = nullptr;
+        size_t count = 0;
+
+        double* data() const {return ptr;}
+        size_t size() const {return count;}
+        double& operator[](size_t i) const {return ptr[i];}
+        double* begin() const {return ptr;}
+        double* end() const {return ptr + count;}
+};
+
+// Number format used for inference, training always uses doubles
+enum Precision {FLOAT64, FLOAT32, INT8};
+
+// Exact loss, accuracy and confusion matrix of a network over a dataset
+struct Metrics {
+    public:
+        size_t numClasses = 0;
+        size_t count = 0;
+        size_t correct = 0;
+        double totalLoss = 0.0;
+        std::vector<size_t> confusion; // numClasses x numClasses, rows are actual classes, columns predicted ones
+
+        Metrics(size_t numClassesIn = 0) : numClasses(numClassesIn), confusion(numClassesIn*numClassesIn, 0) {}
+
+        double loss() const {return count ? totalLoss / count : 0.0;} // mean per instance
+        double accuracy() const {return count ? (double)correct / count : 0.0;}
+        size_t actual(size_t c) const; // instances of class c
+        size_t predicted(size_t c) const; // instances predicted as class c
+        double precision(size_t c) const; // share of the instances predicted as c that are c, 0 when none are
+        double recall(size_t c) const; // share of the instances of c predicted as c, 0 when there are none
+
+        void merge(const Metrics& other);
+};
+
+// Node view into a row of its layer's weights that affect the output the network
 struct Node {
     public:
-        std::vector<double> weights;
-        double bias;
-        
-        Node(const size_t& numAxon);
+        double* weights;
+        size_t numAxon;
+        double* bias;
+
+        Node(double* weightsIn, size_t numAxonIn, double* biasIn)
+            : weights(weightsIn), numAxon(numAxonIn), bias(biasIn) {}
 
-        void randomize();
+        void randomize(double limit, RandomStream& random); // weights uniform in [-limit, limit]
         void show(); // display node information
 };
 
 // Layer class that contains nodes
 struct Layer {
     private:
-        double sigmoid(double x) {return 1/(1+std::exp(-x));}
+        AlignedVector<double> storage; // weights then biases, unless they live elsewhere
+        void view(double* weightsIn, double* biasesIn, size_t size);
     public:
         size_t numInputs;
-        std::vector<Node*> nodes;
+        Activation activation;
+        Parameters weights; // row-major, one row of numInputs per node
+        Parameters biases;
+        std::vector<Node> nodes; // views into weights and biases
 
-        Layer(const size_t& size, const size_t& prevLayerSize);
-        ~Layer() {for (auto x : nodes) delete x;}
+        // optimizer state, one entry per weight then one per bias, sized by the optimizer's first update
+        AlignedVector<double> velocity; // momentum, or Adam's first moment
+        AlignedVector<double> squares; // Adam's second moment
 
-        // method for calculating the output of a layer
-        std::vector<double> calculate(std::vector<double> input);
+        // reduced precision copies of the parameters for inference, made by quantize()
+        AlignedVector<float> weights32;
+        AlignedVector<float> biases32;
+        AlignedVector<int8_t> weights8; // weights / weightScale, rounded, rows of stride8
+        size_t stride8 = 0; // numInputs padded with zeros to whole vectors, int8 inputs are as long
+        float weightScale = 1.0f;
+        float inputScale = 1.0f; // int8 inputs are input / inputScale, rounded
 
-        void randomize() {for (auto node : nodes) node->randomize();}
+        // the weights left by pruning, empty while the layer is dense
+        // training keeps the weights outside its pattern at zero
+        // it is kept beside the dense weights, which training and the other precisions still use,
+        // so pruning saves inference time and checkpoint size but not memory
+        SparseMatrix sparse;
+
+        Layer(const size_t& size, const size_t& prevLayerSize, Activation activationIn=SIGMOID); // zeroed, see randomize
+        Layer(const size_t& size, const size_t& prevLayerSize, double* weightsIn, double* biasesIn,
+            Activation activationIn=SIGMOID);
+
+        void own(); // copy parameters viewed elsewhere into the layer's own storage
+        Layer(const Layer&) = delete;
+        Layer& operator=(const Layer&) = delete;
+
+        // methods for calculating the output of a layer
+        void calculate(const double* input, double* output);
+        void weighted_sums(const double* input, double* output); // calculate() without the activation
+        std::vector<double> calculate(const std::vector<double>& input);
+        // the batch methods take one sample per row and leave the weighted sums when not activated
+        void calculate_batch(const Matrix& input, Matrix& output, bool activated=true);
+        void calculate(const float* input, float* output);
+        void calculate(const int8_t* input, float* output); // input quantized with inputScale, stride8 long
+        void calculate_batch(const float* input, float* output, size_t rows, bool activated=true);
+        void calculate_batch(const int8_t* input, float* output, size_t rows, AlignedVector<int32_t>& sums,
+            bool activated=true);
+
+        // refresh the reduced precision copies, inputMax is the largest input magnitude to expect
+        void quantize(double inputMax);
+
+        // zero the weights smaller than threshold in magnitude and keep the rest in the sparse layout
+        void prune(double threshold);
+        // threshold that prunes the given fraction of the weights, smallest magnitudes first
+        double sparsity_threshold(double sparsity) const;
+        void sparsify(); // sparse layout of the nonzero weights, none when every weight is nonzero
+        // density below SPARSE_DENSITY, or SPARSE_BATCH_DENSITY for batches, where the sparse kernels win
+        bool use_sparse(bool batch = false) const;
+
+        void randomize(const RandomStream& random); // range suited to the activation, node n draws from random.child(n)
         void show(); // display layer information
 };
 
 // Neural Network class that contains layers of node
 struct NeuralNetwork {
     private:
-        // methods for calculating the inefficiency of the network
-        double loss(DataInstance dataInstance);
-        double loss(std::vector<DataInstance> dataset);
+        // scratch space for backpropagating one instance at a time
+        struct Workspace {
+            public:
+                std::vector<std::vector<double>> activations; // output of every layer
+                std::vector<double> delta;
+                std::vector<double> prev_delta;
+        };
+
+        // per-chunk buffers reused between learning steps
+        std::vector<Gradient> chunk_gradients;
+        std::vector<Workspace> chunk_workspaces;
+        Gradient step_gradient;
 
         // methods for driving the change to the network
-        void apply_gradient(std::vector<std::vector<std::vector<double>>>&, std::vector<std::vector<double>>& biases);
-        void learn(std::vector<DataInstance> dataset, double learnRate);
+        void zero_gradient(Gradient& gradient);
+        void backpropagate(const double* features, int label, Gradient& gradient, Workspace& workspace);
+        void gradient(const DatasetView& dataset, Gradient& gradient);
+        void apply_gradient(Gradient& gradient, double learnRate);
     public:
         std::vector<Layer*> layers;
+        std::shared_ptr<MappedFile> mapping; // checkpoint the layers view, if any
+        Telemetry* telemetry = nullptr; // records training timings when set
+        Optimizer optimizer; // how learn() turns gradients into updates, from config.h
+        bool quiet = false; // train() keeps its progress to itself
+        Normalization normalization; // raw features need it before calculate(), taken from the training data
 
-        NeuralNetwork(const std::vector<size_t>& layerSizes);
+        NeuralNetwork();
+        // one activation per layer after the input, empty uses the ones in config.h
+        // the weights are randomized for the given run, see randomize
+        NeuralNetwork(const std::vector<size_t>& layerSizes, const std::vector<Activation>& activations = {},
+            uint64_t run = 0);
         ~NeuralNetwork() {for (auto x : layers) delete x;}
 
+        // methods for calculating the inefficiency of the network
+        // cross-entropy when the output layer is softmax, squared error otherwise
+        double loss(const double* features, int label);
+        double loss(const DatasetView& dataset); // exact mean over every instance
+
+        // loss, accuracy and confusion matrix in one parallel pass over the dataset
+        Metrics evaluate(const DatasetView& dataset, Precision precision = FLOAT64);
+
+        // single learning step over a whole dataset, learnRate is adjusted by the optimizer's schedule
+        void learn(const DatasetView& dataset, double learnRate);
+        // clear the optimizer state and step count before a run of totalSteps learning steps
+        void reset_optimizer(size_t totalSteps);
+
         // methods used to train and test the network
-        void train(std::vector<DataInstance> trainset, std::vector<DataInstance> testset, 
-            size_t max_iteration, double learn_rate);
-        double test(std::vector<DataInstance> testset);
+        // the validation rows pick the weights to keep and when to stop early, keep them apart from the test rows
+        void train(const DatasetView& trainset, const DatasetView& validation,
+            size_t max_iteration, double learn_rate, const std::string& checkpoint = "");
+        double test(const DatasetView& testset, Precision precision = FLOAT64);
+
+        // train on a dataset read from disk in chunks, without holding it all in memory
+        void train(StreamingDataset& stream, size_t epochs, size_t batch_size, double learn_rate,
+            const std::string& checkpoint = "");
 
-        // method to get the outputs
-        std::vector<double> calculate(std::vector<double> input);
+        // compare backpropagation against finite differences, returns the maximum deviation
+        double gradient_check(const DatasetView& dataset);
+
+        // methods to get the outputs
+        std::vector<double> calculate(const std::vector<double>& input);
+        Matrix calculate_batch(const Matrix& input); // one sample per row
+        // the output layer's weighted sums are left unactivated when not activated, eg. for a fused loss
+        Matrix calculate_batch(const Matrix& input, Precision precision, bool activated=true);
+
+        // make the float32 and int8 copies of every layer, calibrating the int8 scales on a dataset
+        // call again whenever the weights change
+        void quantize(const DatasetView& calibration);
+
+        // magnitude pruning of every layer, by a threshold on the weights
+        // or by the fraction of each layer's weights to drop
+        void prune(double threshold);
+        void prune_sparsity(double sparsity);
+        void sparsify(); // sparse layouts for weights that are already partly zero, eg. a pruned checkpoint
+        double density() const; // fraction of the weights that are left
         
-        void randomize() {for (auto layer : layers) layer->randomize();}
+        // copy of the layers and their parameters in its own storage, for evaluating while training goes on
+        NeuralNetwork* clone() const;
+        // take the parameters of a network with the same layer sizes
+        void copy_parameters(const NeuralNetwork& other);
+
+        // the same run always draws the same weights, layer l from the child stream l of the run's stream
+        void randomize(uint64_t run);
         void show(); // display neural network
 };
 
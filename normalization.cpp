@@ -0,0 +1,74 @@
+#include "normalization.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+// Names in enum order
+static const char* NORMALIZATION_NAMES[] = {"none", "zscore", "minmax"};
+
+const char* normalization_name(NormalizationType type) {return NORMALIZATION_NAMES[type];}
+
+NormalizationType parse_normalization(const std::string& name) {
+    for (size_t i=0; i<sizeof(NORMALIZATION_NAMES)/sizeof(*NORMALIZATION_NAMES); i++)
+        if (name == NORMALIZATION_NAMES[i]) return (NormalizationType)i;
+    throw std::invalid_argument("unknown normalization '" + name + "'");
+}
+
+// Transform rows of features in place
+void Normalization::apply(double* features, size_t rows) const {
+    if (empty()) return;
+    size_t cols = size();
+    const double* shifts = shift.data(), *scales = scale.data();
+    for (size_t r=0; r<rows; r++, features+=cols)
+        for (size_t c=0; c<cols; c++)
+            features[c] = (features[c] - shifts[c]) * scales[c];
+}
+
+// Add one row to the statistics
+void FeatureStats::add(const double* row, size_t cols) {
+    if (count == 0) {
+        mean.assign(cols, 0.0);
+        m2.assign(cols, 0.0);
+        min.assign(row, row + cols);
+        max.assign(row, row + cols);
+    }
+    count++;
+    for (size_t c=0; c<cols; c++) {
+        double delta = row[c] - mean[c];
+        mean[c] += delta / count;
+        m2[c] += delta * (row[c] - mean[c]);
+        min[c] = std::min(min[c], row[c]);
+        max[c] = std::max(max[c], row[c]);
+    }
+}
+// Combine with the statistics of other rows (Chan et al.)
+void FeatureStats::merge(const FeatureStats& other) {
+    if (other.count == 0) return;
+    if (count == 0) {*this = other; return;}
+
+    double total = count + other.count;
+    for (size_t c=0; c<mean.size(); c++) {
+        double delta = other.mean[c] - mean[c];
+        mean[c] += delta * other.count / total;
+        m2[c] += other.m2[c] + delta * delta * count * other.count / total;
+        min[c] = std::min(min[c], other.min[c]);
+        max[c] = std::max(max[c], other.max[c]);
+    }
+    count += other.count;
+}
+
+// Transform that rescales features with these statistics
+Normalization FeatureStats::normalization(NormalizationType type) const {
+    Normalization result;
+    if (type == NO_NORMALIZATION || count == 0) return result;
+
+    result.type = type;
+    result.shift.resize(mean.size());
+    result.scale.resize(mean.size());
+    for (size_t c=0; c<mean.size(); c++) {
+        double spread = type == ZSCORE ? std::sqrt(m2[c] / count) : max[c] - min[c];
+        result.shift[c] = type == ZSCORE ? mean[c] : min[c];
+        result.scale[c] = spread > 0 ? 1.0 / spread : 1.0;
+    }
+    return result;
+}
@@ -0,0 +1,52 @@
+#ifndef NORMALIZATION_H
+#define NORMALIZATION_H
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+// How features are rescaled before they reach the network
+enum NormalizationType {NO_NORMALIZATION, ZSCORE, MINMAX};
+
+// Name of a normalization as typed in the console, eg. "zscore"
+const char* normalization_name(NormalizationType type);
+// Normalization with the given name, throws std::invalid_argument for an unknown one
+NormalizationType parse_normalization(const std::string& name);
+
+// Per-feature affine transform, x' = (x - shift) * scale
+struct Normalization {
+    public:
+        NormalizationType type = NO_NORMALIZATION;
+        std::vector<double> shift;
+        std::vector<double> scale;
+
+        bool empty() const {return type == NO_NORMALIZATION || shift.empty();}
+        size_t size() const {return shift.size();}
+        bool operator==(const Normalization& other) const {
+            return type == other.type && shift == other.shift && scale == other.scale;
+        }
+        bool operator!=(const Normalization& other) const {return !(*this == other);}
+
+        // transform rows of size() features in place, does nothing when empty
+        void apply(double* features, size_t rows = 1) const;
+};
+
+// Running per-feature statistics gathered in one pass, Welford's mean and variance plus the range
+// statistics of separate parts of a dataset merge exactly, so chunks can be gathered in parallel
+struct FeatureStats {
+    public:
+        size_t count = 0;
+        std::vector<double> mean;
+        std::vector<double> m2; // sum of squared deviations from the mean
+        std::vector<double> min;
+        std::vector<double> max;
+
+        void add(const double* row, size_t cols);
+        void merge(const FeatureStats& other);
+
+        // z-score uses the population standard deviation, min/max maps the range to [0, 1]
+        // constant features are only shifted
+        Normalization normalization(NormalizationType type) const;
+};
+
+#endif
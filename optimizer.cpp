@@ -0,0 +1,92 @@
+#include "optimizer.h"
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+// Names in enum order
+static const char* OPTIMIZER_NAMES[] = {"sgd", "momentum", "nesterov", "adam", "adamw"};
+static const char* SCHEDULE_NAMES[] = {"constant", "step", "cosine"};
+
+const char* optimizer_name(OptimizerType type) {return OPTIMIZER_NAMES[type];}
+const char* schedule_name(ScheduleType type) {return SCHEDULE_NAMES[type];}
+
+OptimizerType parse_optimizer(const std::string& name) {
+    for (size_t i=0; i<sizeof(OPTIMIZER_NAMES)/sizeof(*OPTIMIZER_NAMES); i++)
+        if (name == OPTIMIZER_NAMES[i]) return (OptimizerType)i;
+    throw std::invalid_argument("unknown optimizer '" + name + "'");
+}
+ScheduleType parse_schedule(const std::string& name) {
+    for (size_t i=0; i<sizeof(SCHEDULE_NAMES)/sizeof(*SCHEDULE_NAMES); i++)
+        if (name == SCHEDULE_NAMES[i]) return (ScheduleType)i;
+    throw std::invalid_argument("unknown schedule '" + name + "'");
+}
+
+// Adaptive optimizers take much smaller steps than plain gradient descent
+double default_learn_rate(OptimizerType type) {
+    switch (type) {
+        case SGD: return 1.0;
+        case MOMENTUM: case NESTEROV: return 0.3;
+        case ADAM: case ADAMW: return 0.03;
+    }
+    return 1.0;
+}
+
+// Learn rate of a step, after a linear warmup
+double Schedule::rate(double learnRate, size_t step, size_t totalSteps) const {
+    if (step < warmupSteps)
+        return learnRate * (step+1) / warmupSteps;
+    step -= warmupSteps;
+
+    switch (type) {
+        case CONSTANT:
+            return learnRate;
+        case STEP:
+            return learnRate * std::pow(decay, (double)(step / std::max<size_t>(stepSize, 1)));
+        case COSINE: {
+            // unknown run lengths keep the full rate
+            if (totalSteps <= warmupSteps) return learnRate;
+            double progress = std::min(1.0, (double)step / (totalSteps - warmupSteps));
+            return learnRate * (minFraction + (1 - minFraction) * 0.5 * (1 + std::cos(M_PI * progress)));
+        }
+    }
+    return learnRate;
+}
+
+// Update a block of parameters, steps has already been counted for this update
+void Optimizer::update(double* parameters, const double* gradient, double* velocity, double* squares,
+    size_t count, double rate, bool decay) const {
+    switch (type) {
+        case SGD:
+            for (size_t i=0; i<count; i++)
+                parameters[i] -= gradient[i] * rate;
+            break;
+        case MOMENTUM:
+            for (size_t i=0; i<count; i++) {
+                velocity[i] = momentum * velocity[i] + gradient[i];
+                parameters[i] -= rate * velocity[i];
+            }
+            break;
+        case NESTEROV:
+            // step from the point the momentum is about to carry the parameters to
+            for (size_t i=0; i<count; i++) {
+                velocity[i] = momentum * velocity[i] + gradient[i];
+                parameters[i] -= rate * (gradient[i] + momentum * velocity[i]);
+            }
+            break;
+        case ADAM:
+        case ADAMW: {
+            // bias corrected moments, folded into the step size
+            double correction1 = 1 - std::pow(momentum, (double)steps);
+            double correction2 = 1 - std::pow(beta2, (double)steps);
+            double step_size = rate * std::sqrt(correction2) / correction1;
+            double epsilon_hat = epsilon * std::sqrt(correction2);
+            double shrink = (type == ADAMW && decay) ? 1 - rate * weightDecay : 1.0;
+            for (size_t i=0; i<count; i++) {
+                velocity[i] = momentum * velocity[i] + (1 - momentum) * gradient[i];
+                squares[i] = beta2 * squares[i] + (1 - beta2) * gradient[i] * gradient[i];
+                parameters[i] = parameters[i] * shrink - step_size * velocity[i] / (std::sqrt(squares[i]) + epsilon_hat);
+            }
+            break;
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <string>
+#include <cstddef>
+
+// Rule turning loss gradients into parameter updates
+enum OptimizerType {SGD, MOMENTUM, NESTEROV, ADAM, ADAMW};
+// How the learn rate changes over the steps of a training run
+enum ScheduleType {CONSTANT, STEP, COSINE};
+
+// Name of an optimizer or schedule as typed in the console, eg. "adam"
+const char* optimizer_name(OptimizerType type);
+const char* schedule_name(ScheduleType type);
+// Optimizer or schedule with the given name, throws std::invalid_argument for an unknown one
+OptimizerType parse_optimizer(const std::string& name);
+ScheduleType parse_schedule(const std::string& name);
+
+// Learn rate that suits an optimizer when none is given
+double default_learn_rate(OptimizerType type);
+
+// Learn rate for every step of a run
+struct Schedule {
+    public:
+        ScheduleType type = CONSTANT;
+        size_t warmupSteps = 0; // linear ramp up to the learn rate before the schedule starts
+        size_t stepSize = 100; // STEP multiplies the rate by decay every stepSize steps
+        double decay = 0.5;
+        double minFraction = 0.0; // COSINE anneals to this fraction of the learn rate
+
+        // rate for a step counted from 0, totalSteps is the length of the run (0 if unknown)
+        double rate(double learnRate, size_t step, size_t totalSteps) const;
+};
+
+// Optimizer settings and the step count of the current run
+// the per-parameter state (momentum and second moments) lives with each layer
+struct Optimizer {
+    public:
+        OptimizerType type = SGD;
+        double momentum = 0.9; // also the first moment decay of Adam
+        double beta2 = 0.999; // second moment decay of Adam
+        double epsilon = 1e-8;
+        double weightDecay = 0.01; // decoupled weight decay of AdamW
+        Schedule schedule;
+
+        size_t steps = 0; // updates made so far in this run
+        size_t totalSteps = 0; // expected length of the run, for the schedule
+
+        // whether the optimizer keeps velocity or moment state
+        bool has_velocity() const {return type != SGD;}
+        bool has_squares() const {return type == ADAM || type == ADAMW;}
+
+        // update count parameters in place from their gradients, with the state kept beside them
+        // decay marks weights, which AdamW shrinks, biases are never decayed
+        void update(double* parameters, const double* gradient, double* velocity, double* squares,
+            size_t count, double rate, bool decay) const;
+};
+
+#endif
@@ -0,0 +1,187 @@
+#include "config.h"
+#include "predict.h"
+#include "dataset.h"
+#include "static_network.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <stdexcept>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <charconv>
+#include <cerrno>
+#include <unistd.h>
+
+// Bytes requested from the input per read
+static const size_t READ_BYTES = 1 << 16;
+// Batches worth of parsed rows the reader may run ahead of the network
+static const size_t QUEUE_BATCHES = 4;
+
+// Network specialized for the layer sizes in config.h
+typedef StaticNetwork<STATIC_NETWORK_LAYERS> ServingNetwork;
+
+// Parsed rows handed from the reader thread to the network
+struct RowQueue {
+    public:
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::vector<double> features; // row-major, rows before first were already taken
+        size_t first = 0;
+        size_t count = 0;
+        bool done = false; // no more rows will arrive
+        bool stopping = false; // the reader should give up
+        std::exception_ptr error;
+};
+
+// Reader thread body, parses complete lines as they arrive and queues their features
+// normalized the way the network's training data was
+static void read_rows(int input, size_t numFeatures, const Normalization& normalization, const PredictOptions& options,
+    size_t batchSize, RowQueue& queue) {
+    std::vector<char> text;
+    std::vector<double> row, parsed;
+    char delimiter = options.delimiter;
+    size_t line = 1;
+    bool eof = false;
+
+    try {
+        while (!eof) {
+            // append whatever is available, a pipe returns as soon as it has data
+            size_t used = text.size();
+            text.resize(used + READ_BYTES);
+            ssize_t received = ::read(input, text.data() + used, READ_BYTES);
+            if (received < 0 && errno == EINTR) {text.resize(used); continue;}
+            if (received < 0) throw std::runtime_error(std::string("failed to read input: ") + std::strerror(errno));
+            text.resize(used + received);
+            eof = received == 0;
+
+            // parse every complete line, or the rest of the text at the end of the input
+            parsed.clear();
+            const char* cursor = text.data(), *end = text.data() + text.size();
+            while (cursor < end) {
+                const char* line_end = static_cast<const char*>(std::memchr(cursor, '\n', end-cursor));
+                if (!line_end && !eof) break;
+                if (!line_end) line_end = end;
+
+                if (!delimiter) delimiter = detect_delimiter(cursor, line_end);
+                if (parse_features(cursor, line_end, delimiter, options.labelColumn, numFeatures, row, line)) {
+                    normalization.apply(row.data());
+                    parsed.insert(parsed.end(), row.begin(), row.end());
+                }
+                cursor = line_end + (line_end < end);
+                line++;
+            }
+            text.erase(text.begin(), text.begin() + (cursor - text.data()));
+
+            // hand the rows over once the network has caught up
+            if (parsed.empty()) continue;
+            std::unique_lock<std::mutex> lock(queue.mutex);
+            queue.changed.wait(lock, [&]() {return queue.stopping || queue.count < QUEUE_BATCHES*batchSize;});
+            if (queue.stopping) return;
+            queue.features.erase(queue.features.begin(), queue.features.begin() + queue.first*numFeatures);
+            queue.first = 0;
+            queue.features.insert(queue.features.end(), parsed.begin(), parsed.end());
+            queue.count += parsed.size() / numFeatures;
+            parsed.clear();
+            queue.changed.notify_all();
+        }
+    } catch (...) {
+        // rows before the bad line are still scored
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.features.insert(queue.features.end(), parsed.begin(), parsed.end());
+        queue.count += parsed.size() / numFeatures;
+        queue.error = std::current_exception();
+    }
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.done = true;
+    queue.changed.notify_all();
+}
+
+// Append the prediction for every row of the network's output
+static void format_predictions(const Matrix& output, const PredictOptions& options, std::string& text) {
+    char number[32];
+    for (size_t i=0; i<output.rows; i++) {
+        const double* row = output[i];
+        if (options.probabilities) {
+            for (size_t n=0; n<output.cols; n++) {
+                if (n) text += ',';
+                char* number_end = std::to_chars(number, number + sizeof(number), row[n],
+                    std::chars_format::general, 6).ptr;
+                text.append(number, number_end);
+            }
+        } else {
+            // the maximum node is considered to be the predicted class
+            size_t maxIdx = std::distance(row, std::max_element(row, row + output.cols));
+            if (options.classes.size() == output.cols) text += options.classes[maxIdx];
+            else text += std::to_string(maxIdx);
+        }
+        text += '\n';
+    }
+}
+
+// Score rows from input in micro-batches, filled up to batchSize or until the timeout runs out
+size_t predict_stream(NeuralNetwork& nn, int input, FILE* output, const PredictOptions& options) {
+    if (nn.layers.empty()) throw std::runtime_error("the network has no layers");
+    size_t numFeatures = nn.layers.front()->nodes.size(); // the input layer
+    size_t batchSize = std::max<size_t>(options.batchSize, 1);
+    auto timeout = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(std::max(options.timeout, 0.0)));
+
+    // double precision runs through the specialized network when the sizes match
+    std::unique_ptr<ServingNetwork> serving;
+    if (options.precision == FLOAT64 && ServingNetwork::matches(nn))
+        serving.reset(new ServingNetwork(nn));
+
+    // the specialized network scales raw rows itself, the dynamic one takes them scaled by the reader
+    Normalization unscaled;
+    const Normalization& normalization = serving ? unscaled : nn.normalization;
+
+    RowQueue queue;
+    std::thread reader(read_rows, input, numFeatures, std::cref(normalization), std::cref(options), batchSize, std::ref(queue));
+
+    Matrix batch;
+    std::string text;
+    size_t scored = 0;
+    try {
+        std::unique_lock<std::mutex> lock(queue.mutex);
+        while (true) {
+            // start a batch with the first row to arrive, then give it until the timeout to fill
+            queue.changed.wait(lock, [&]() {return queue.count > 0 || queue.done;});
+            if (queue.count == 0) break;
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            queue.changed.wait_until(lock, deadline, [&]() {return queue.count >= batchSize || queue.done;});
+
+            size_t rows = std::min(queue.count, batchSize);
+            const double* features = queue.features.data() + queue.first*numFeatures;
+            batch.resize(rows, numFeatures);
+            std::copy(features, features + rows*numFeatures, batch.data.data());
+            queue.first += rows;
+            queue.count -= rows;
+            queue.changed.notify_all();
+            lock.unlock();
+
+            // one pass through the network for the whole batch, written out before the next one
+            text.clear();
+            format_predictions(serving ? serving->calculate_batch(batch) : nn.calculate_batch(batch, options.precision),
+                options, text);
+            if (std::fwrite(text.data(), 1, text.size(), output) != text.size() || std::fflush(output) != 0)
+                throw std::runtime_error(std::string("failed to write predictions: ") + std::strerror(errno));
+            scored += rows;
+
+            lock.lock();
+        }
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.stopping = true;
+            queue.changed.notify_all();
+        }
+        reader.join();
+        throw;
+    }
+    reader.join();
+
+    if (queue.error) std::rethrow_exception(queue.error);
+    return scored;
+}
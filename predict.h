@@ -0,0 +1,26 @@
+#ifndef PREDICT_H
+#define PREDICT_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include "neural_network.h"
+
+// How rows are read and predictions are written when scoring without the console
+struct PredictOptions {
+    public:
+        size_t batchSize = 1024; // rows per pass through the network
+        double timeout = 0.01; // seconds to wait for a batch to fill before running a partial one
+        Precision precision = FLOAT64; // reduced precisions need the network quantized first
+        bool probabilities = false; // write every output instead of the predicted class
+        char delimiter = 0; // 0 detects it from the first line
+        int labelColumn = -1; // skipped in rows that carry a label, negative counts from the last column
+        std::vector<std::string> classes; // printed instead of the class index when there is one per output
+};
+
+// Read CSV rows from the input file descriptor until it closes, running them through the network
+// in micro-batches and writing one line per row to output in input order, returns the rows scored
+// throws std::runtime_error with the line and column of bad input, after writing the rows before it
+size_t predict_stream(NeuralNetwork& nn, int input, FILE* output, const PredictOptions& options);
+
+#endif
@@ -0,0 +1,71 @@
+#include "config.h"
+#include "rng.h"
+
+// Philox4x32 multipliers and Weyl key increments
+static const uint32_t PHILOX_M0 = 0xD2511F53, PHILOX_M1 = 0xCD9E8D57;
+static const uint32_t PHILOX_W0 = 0x9E3779B9, PHILOX_W1 = 0xBB67AE85;
+
+// Philox4x32-10 block
+void philox4x32(uint64_t key, const uint32_t counter[4], uint32_t output[4]) {
+    uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    for (int round=0; round<10; round++) {
+        uint64_t product0 = (uint64_t)PHILOX_M0 * c0;
+        uint64_t product1 = (uint64_t)PHILOX_M1 * c2;
+        uint32_t next0 = (uint32_t)(product1 >> 32) ^ c1 ^ k0;
+        uint32_t next2 = (uint32_t)(product0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t)product1;
+        c3 = (uint32_t)product0;
+        c0 = next0;
+        c2 = next2;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    output[0] = c0; output[1] = c1; output[2] = c2; output[3] = c3;
+}
+
+// Spread the bits of an id, so nearby ids give unrelated children (SplitMix64 finalizer)
+static uint64_t mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// Stream for a subtask
+RandomStream RandomStream::child(uint64_t index) const {
+    return RandomStream(seed, mix(id + mix(index + 0x9E3779B97F4A7C15ull)));
+}
+
+// Next 32 random bits, a new block every four calls
+uint32_t RandomStream::next32() {
+    if (used == 4) {
+        uint32_t counter[4] = {(uint32_t)position, (uint32_t)(position >> 32), (uint32_t)id, (uint32_t)(id >> 32)};
+        philox4x32(seed, counter, block);
+        position++;
+        used = 0;
+    }
+    return block[used++];
+}
+uint64_t RandomStream::next64() {
+    uint64_t low = next32();
+    return ((uint64_t)next32() << 32) | low;
+}
+
+// Uniform integer in [0, n) by multiplying into 128 bits and rejecting the biased few (Lemire)
+uint64_t RandomStream::below(uint64_t n) {
+    unsigned __int128 product = (unsigned __int128)next64() * n;
+    uint64_t low = (uint64_t)product;
+    if (low < n) {
+        uint64_t threshold = -n % n;
+        while (low < threshold) {
+            product = (unsigned __int128)next64() * n;
+            low = (uint64_t)product;
+        }
+    }
+    return (uint64_t)(product >> 64);
+}
+
+// Stream of a purpose derived from the configured seed
+RandomStream random_stream(RandomPurpose purpose, uint64_t index) {
+    return RandomStream(RANDOM_SEED, mix(purpose + 1)).child(index);
+}
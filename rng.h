@@ -0,0 +1,55 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+/*
+Counter-based random numbers, Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3")
+every block of four numbers is a pure function of a key (the seed) and a 128-bit counter,
+so a stream is just a stream id plus a position, and tasks can each take a stream of their own
+without any shared state, giving the same numbers whichever thread runs them
+*/
+
+// Philox4x32-10 block for a 64-bit key and 128-bit counter, in and out as four 32-bit words
+void philox4x32(uint64_t key, const uint32_t counter[4], uint32_t output[4]);
+
+// Independent sequence of random numbers, the high half of the counter is the stream id
+struct RandomStream {
+    private:
+        uint64_t seed = 0;
+        uint64_t id = 0;
+        uint64_t position = 0; // blocks drawn so far
+        uint32_t block[4];
+        unsigned used = 4; // numbers of block already handed out
+    public:
+        RandomStream() {}
+        RandomStream(uint64_t seedIn, uint64_t idIn) : seed(seedIn), id(idIn) {}
+
+        // stream for a subtask, eg. one per node or fold, independent of this one and its other children
+        RandomStream child(uint64_t index) const;
+
+        uint32_t next32();
+        uint64_t next64();
+        // uniform double in [0, 1) with 53 random bits
+        double uniform() {return (next64() >> 11) * (1.0 / (1ull << 53));}
+        double uniform(double low, double high) {return low + (high - low) * uniform();}
+        // uniform integer in [0, n), n > 0, without modulo bias
+        uint64_t below(uint64_t n);
+};
+
+// Fisher-Yates shuffle, the same order on every platform unlike std::shuffle
+template <class T>
+void shuffle(T* items, size_t count, RandomStream& random) {
+    for (size_t i=count; i>1; i--)
+        std::swap(items[i-1], items[random.below(i)]);
+}
+
+// What random numbers are used for, every purpose draws from streams no other purpose does
+enum RandomPurpose {WEIGHT_INIT, DATA_SPLIT, RESAMPLING, SEARCH, STREAM_SHUFFLE, VALIDATION_SPLIT};
+
+// Stream number index of a purpose, derived from RANDOM_SEED in config.h
+RandomStream random_stream(RandomPurpose purpose, uint64_t index = 0);
+
+#endif
@@ -0,0 +1,92 @@
+#include "sampling.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+// Rows grouped by their label
+std::vector<std::vector<size_t>> rows_by_class(const Dataset& dataset, const std::vector<size_t>& rows) {
+    std::vector<std::vector<size_t>> groups(dataset.classes.size());
+    for (auto row : rows) {
+        size_t label = dataset.labels[row];
+        if (label >= groups.size()) groups.resize(label+1);
+        groups[label].push_back(row);
+    }
+    return groups;
+}
+
+// Split every class by testFraction
+void stratified_split(const Dataset& dataset, const std::vector<size_t>& rows, double testFraction, RandomStream& random,
+    std::vector<size_t>& train_rows, std::vector<size_t>& test_rows) {
+    train_rows.clear();
+    test_rows.clear();
+    for (auto& group : rows_by_class(dataset, rows)) {
+        shuffle(group.data(), group.size(), random);
+        size_t split_index = (1.0 - testFraction) * group.size();
+        train_rows.insert(train_rows.end(), group.begin(), group.begin()+split_index);
+        test_rows.insert(test_rows.end(), group.begin()+split_index, group.end());
+    }
+
+    // mix the classes back together
+    shuffle(train_rows.data(), train_rows.size(), random);
+    shuffle(test_rows.data(), test_rows.size(), random);
+}
+
+// Split the distinct rows, then keep every training row that wasn't held out
+void validation_split(const Dataset& dataset, const std::vector<size_t>& rows, double fraction, RandomStream& random,
+    std::vector<size_t>& fit_rows, std::vector<size_t>& validation_rows) {
+    std::vector<size_t> distinct(rows);
+    std::sort(distinct.begin(), distinct.end());
+    distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+
+    std::vector<size_t> kept;
+    stratified_split(dataset, distinct, fraction, random, kept, validation_rows);
+
+    std::vector<size_t> held(validation_rows);
+    std::sort(held.begin(), held.end());
+    fit_rows.clear();
+    for (auto row : rows)
+        if (!std::binary_search(held.begin(), held.end(), row)) fit_rows.push_back(row);
+}
+
+// Deal each class into k folds
+std::vector<std::vector<size_t>> stratified_folds(const Dataset& dataset, const std::vector<size_t>& rows,
+    size_t k, RandomStream& random) {
+    if (k < 2 || k > rows.size())
+        throw std::invalid_argument("expected between 2 and " + std::to_string(rows.size()) + " folds");
+
+    std::vector<std::vector<size_t>> folds(k);
+    size_t next = 0; // carries on from class to class so the remainders spread over the folds
+    for (auto& group : rows_by_class(dataset, rows)) {
+        shuffle(group.data(), group.size(), random);
+        for (auto row : group) {
+            folds[next].push_back(row);
+            next = (next+1) % k;
+        }
+    }
+    return folds;
+}
+
+// Resample every class to the same number of rows
+std::vector<size_t> resample_rows(const Dataset& dataset, const std::vector<size_t>& rows, double ratio,
+    RandomStream& random) {
+    std::vector<std::vector<size_t>> groups = rows_by_class(dataset, rows);
+    size_t target = rows.size()*ratio / groups.size();
+
+    std::vector<size_t> resampled;
+    resampled.reserve(target * groups.size());
+    for (auto& group : groups) {
+        if (group.empty()) continue;
+        if (group.size() >= target) {
+            // undersample with a partial shuffle, the first target rows are a random pick
+            for (size_t i=0; i<target; i++)
+                std::swap(group[i], group[i + random.below(group.size()-i)]);
+            resampled.insert(resampled.end(), group.begin(), group.begin()+target);
+        } else {
+            // oversample, keeping every original row once
+            resampled.insert(resampled.end(), group.begin(), group.end());
+            for (size_t i=group.size(); i<target; i++)
+                resampled.push_back(group[random.below(group.size())]);
+        }
+    }
+    return resampled;
+}
@@ -0,0 +1,34 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <vector>
+#include <cstddef>
+#include "dataset.h"
+#include "rng.h"
+
+// Selections of dataset rows by index, the features themselves are never copied
+
+// Rows grouped by their label, in their original order
+std::vector<std::vector<size_t>> rows_by_class(const Dataset& dataset, const std::vector<size_t>& rows);
+
+// Split rows into training and testing rows with every class split by testFraction
+// each class is shuffled first, and both results come out shuffled
+void stratified_split(const Dataset& dataset, const std::vector<size_t>& rows, double testFraction, RandomStream& random,
+    std::vector<size_t>& train_rows, std::vector<size_t>& test_rows);
+
+// Hold a stratified validation slice of fraction out of training rows, for picking epochs without the test rows
+// a row repeated by resampling lands wholly on one side, the fit rows keep their order and repeats
+void validation_split(const Dataset& dataset, const std::vector<size_t>& rows, double fraction, RandomStream& random,
+    std::vector<size_t>& fit_rows, std::vector<size_t>& validation_rows);
+
+// Deal the shuffled rows of each class in turn into k folds, so folds differ in size by at most one row
+// and keep the class proportions of rows
+std::vector<std::vector<size_t>> stratified_folds(const Dataset& dataset, const std::vector<size_t>& rows,
+    size_t k, RandomStream& random);
+
+// Rows with rows.size()*ratio/numClasses of each class, majority classes are undersampled
+// without repeats and minority classes oversampled by repeating random rows
+std::vector<size_t> resample_rows(const Dataset& dataset, const std::vector<size_t>& rows, double ratio,
+    RandomStream& random);
+
+#endif
@@ -0,0 +1,250 @@
+#ifndef STATIC_NETWORK_H
+#define STATIC_NETWORK_H
+
+#include <array>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include "neural_network.h"
+#include "checkpoint.h"
+#include "dataset.h"
+#include "matrix.h"
+
+// Neural network with its layer sizes fixed at compile time, eg. StaticNetwork<4, 5, 3>
+// every loop has a constant trip count, so the small layers unroll and vectorize completely
+// every layer uses the sigmoid activation
+template <size_t... Sizes>
+struct StaticNetwork {
+    public:
+        static constexpr size_t numLayers = sizeof...(Sizes);
+        static constexpr std::array<size_t, numLayers> sizes = {Sizes...};
+        static_assert(numLayers >= 2, "a network needs an input layer and an output layer");
+    private:
+        // layer l > 0 stores its row-major weights then its biases, like a checkpoint does
+        static constexpr size_t weight_offset(size_t l) {
+            size_t offset = 0;
+            for (size_t i=1; i<l; i++) offset += sizes[i]*sizes[i-1] + sizes[i];
+            return offset;
+        }
+        static constexpr size_t bias_offset(size_t l) {return weight_offset(l) + sizes[l]*sizes[l-1];}
+        static constexpr size_t max_width() {
+            size_t width = 0;
+            for (size_t size : sizes) width = std::max(width, size);
+            return width;
+        }
+    public:
+        static constexpr size_t numInputs = sizes.front();
+        static constexpr size_t numOutputs = sizes.back();
+        static constexpr size_t numParameters = weight_offset(numLayers);
+        static constexpr size_t width = max_width();
+        static constexpr size_t batchSize = 8; // samples a batched forward pass carries side by side
+        typedef std::array<std::array<double, width>, numLayers> Activations;
+        typedef std::array<std::array<double, width*batchSize>, numLayers> BatchActivations; // node-major, sample-minor
+
+        alignas(64) std::array<double, numParameters> parameters{};
+        // calculate() and calculate_batch() take raw features and scale them with it, datasets arrive already scaled
+        Normalization normalization;
+
+        StaticNetwork() {}
+        // copy the parameters and normalization of a dynamic network with the same layer sizes
+        StaticNetwork(const NeuralNetwork& nn) {
+            if (!matches(nn)) throw std::invalid_argument("layers don't match the static network");
+            if (!nn.normalization.empty() && nn.normalization.size() != numInputs)
+                throw std::invalid_argument("normalization doesn't match the static network's inputs");
+            normalization = nn.normalization;
+            for (size_t l=1; l<numLayers; l++) {
+                std::copy(nn.layers[l]->weights.begin(), nn.layers[l]->weights.end(), &parameters[weight_offset(l)]);
+                std::copy(nn.layers[l]->biases.begin(), nn.layers[l]->biases.end(), &parameters[bias_offset(l)]);
+            }
+        }
+
+        // whether a dynamic network has exactly these layer sizes and sigmoid activations
+        static bool matches(const NeuralNetwork& nn) {
+            if (nn.layers.size() != numLayers) return false;
+            for (size_t l=0; l<numLayers; l++)
+                if (nn.layers[l]->nodes.size() != sizes[l] || (l && nn.layers[l]->activation != SIGMOID)) return false;
+            return true;
+        }
+        // dynamic copy of the network, eg. for checkpoints
+        NeuralNetwork* dynamic() const {
+            NeuralNetwork* nn = new NeuralNetwork(std::vector<size_t>(sizes.begin(), sizes.end()),
+                std::vector<Activation>(numLayers-1, SIGMOID));
+            for (size_t l=1; l<numLayers; l++) {
+                std::copy(&parameters[weight_offset(l)], &parameters[bias_offset(l)], nn->layers[l]->weights.begin());
+                std::copy(&parameters[bias_offset(l)], &parameters[bias_offset(l)] + sizes[l], nn->layers[l]->biases.begin());
+            }
+            nn->normalization = normalization;
+            return nn;
+        }
+
+        // methods to get the outputs
+        void calculate(const double* input, double* output) const {
+            Activations activations;
+            std::copy(input, input + numInputs, activations[0].data());
+            normalization.apply(activations[0].data());
+            forward(activations, std::make_index_sequence<numLayers-1>());
+            std::copy(activations.back().data(), activations.back().data() + numOutputs, output);
+        }
+        Matrix calculate_batch(const Matrix& input) const {
+            if (input.cols != numInputs)
+                throw std::invalid_argument("expected " + std::to_string(numInputs) + " inputs, got " + std::to_string(input.cols));
+            Matrix output(input.rows, numOutputs);
+            calculate_rows(input.rows, [&input](size_t r) {return input[r];},
+                [&output](size_t r, const double* out) {std::copy(out, out + numOutputs, output[r]);}, true);
+            return output;
+        }
+
+        // exact average loss of a dataset
+        double loss(const DatasetView& dataset) const {
+            double total_loss = 0.0;
+            calculate_rows(dataset.size(), [&dataset](size_t i) {return dataset.features(i);},
+                [&dataset, &total_loss](size_t i, const double* output) {
+                    for (size_t n=0; n<numOutputs; n++) {
+                        double error = output[n] - (n == (size_t)dataset.label(i) ? 1.0 : 0.0);
+                        total_loss += error*error;
+                    }
+                });
+            return dataset.size() ? total_loss / dataset.size() : 0.0;
+        }
+
+        // single plain gradient descent step over a whole dataset
+        void learn(const DatasetView& dataset, double learnRate) {
+            if (dataset.size() == 0) return;
+            gradient.fill(0.0);
+            Activations activations;
+            for (size_t i=0; i<dataset.size(); i++) {
+                std::copy(dataset.features(i), dataset.features(i) + numInputs, activations[0].data());
+                forward(activations, std::make_index_sequence<numLayers-1>());
+
+                // error of the output layer for the squared error loss
+                std::array<double, width> delta;
+                for (size_t n=0; n<numOutputs; n++) {
+                    double output = activations.back()[n];
+                    double expected = (n == (size_t)dataset.label(i)) ? 1.0 : 0.0;
+                    delta[n] = 2 * (output - expected) * output * (1 - output);
+                }
+                backward(activations, delta, std::make_index_sequence<numLayers-1>());
+            }
+
+            double scale = learnRate / dataset.size();
+            for (size_t p=0; p<numParameters; p++)
+                parameters[p] -= gradient[p] * scale;
+        }
+
+        // accuracy of the predictions on a testing set
+        double test(const DatasetView& testset) const {
+            size_t correct = 0;
+            calculate_rows(testset.size(), [&testset](size_t i) {return testset.features(i);},
+                [&testset, &correct](size_t i, const double* output) {
+                    // the maximum node is considered to be the predicted class
+                    int maxIdx = std::distance(output, std::max_element(output, output + numOutputs));
+                    if (maxIdx == testset.label(i)) correct++;
+                });
+            return testset.size() ? (double)correct / (double)testset.size() : 0.0;
+        }
+    private:
+        alignas(64) std::array<double, numParameters> gradient{}; // summed over a learning step
+
+        // outputs of count rows, batchSize at a time, features(i) is the input of row i and output(i, values) takes its outputs
+        // raw rows are scaled with the normalization on the way in
+        template <class Features, class Output>
+        void calculate_rows(size_t count, Features features, Output output, bool raw = false) const {
+            bool scaled = raw && !normalization.empty();
+            alignas(64) BatchActivations activations;
+            std::array<double, numOutputs> values;
+            for (size_t start=0; start<count; start+=batchSize) {
+                size_t rows = std::min(batchSize, count - start);
+                // a short last batch repeats its last row rather than reading past the end
+                for (size_t b=0; b<batchSize; b++) {
+                    const double* input = features(start + std::min(b, rows-1));
+                    for (size_t w=0; w<numInputs; w++)
+                        activations[0][w*batchSize + b] = scaled ?
+                            (input[w] - normalization.shift[w]) * normalization.scale[w] : input[w];
+                }
+                forward_batch(activations, std::make_index_sequence<numLayers-1>());
+                for (size_t b=0; b<rows; b++) {
+                    for (size_t n=0; n<numOutputs; n++) values[n] = activations.back()[n*batchSize + b];
+                    output(start + b, values.data());
+                }
+            }
+        }
+
+        // output of layer L from the output of layer L-1
+        template <size_t L>
+        void forward_layer(const double* input, double* output) const {
+            constexpr size_t numNodes = sizes[L], numAxon = sizes[L-1];
+            const double* weights = &parameters[weight_offset(L)];
+            const double* biases = &parameters[bias_offset(L)];
+            for (size_t n=0; n<numNodes; n++)
+                output[n] = biases[n] + dot(weights + n*numAxon, input, numAxon);
+            activate(SIGMOID, output, numNodes);
+        }
+        template <size_t... L>
+        void forward(Activations& activations, std::index_sequence<L...>) const {
+            (forward_layer<L+1>(activations[L].data(), activations[L+1].data()), ...);
+        }
+        // the same for batchSize samples, each weight scales a whole vector of samples instead of ending a dot product
+        template <size_t L>
+        void forward_layer_batch(const double* input, double* output) const {
+            constexpr size_t numNodes = sizes[L], numAxon = sizes[L-1];
+            const double* weights = &parameters[weight_offset(L)];
+            const double* biases = &parameters[bias_offset(L)];
+            for (size_t n=0; n<numNodes; n++) {
+                std::array<double, batchSize> sums;
+                sums.fill(biases[n]);
+                for (size_t w=0; w<numAxon; w++)
+                    for (size_t b=0; b<batchSize; b++) sums[b] += weights[n*numAxon + w] * input[w*batchSize + b];
+                std::copy(sums.begin(), sums.end(), output + n*batchSize);
+            }
+            activate(SIGMOID, output, numNodes*batchSize);
+        }
+        template <size_t... L>
+        void forward_batch(BatchActivations& activations, std::index_sequence<L...>) const {
+            (forward_layer_batch<L+1>(activations[L].data(), activations[L+1].data()), ...);
+        }
+
+        // accumulate the gradients of layer L and turn delta into the error of layer L-1
+        template <size_t L>
+        void backward_layer(const Activations& activations, std::array<double, width>& delta) {
+            constexpr size_t numNodes = sizes[L], numAxon = sizes[L-1];
+            const double* input = activations[L-1].data();
+            const double* weights = &parameters[weight_offset(L)];
+            double* weight_gradient = &gradient[weight_offset(L)];
+            double* bias_gradient = &gradient[bias_offset(L)];
+
+            std::array<double, width> prev_delta{};
+            for (size_t n=0; n<numNodes; n++) {
+                for (size_t w=0; w<numAxon; w++) {
+                    weight_gradient[n*numAxon + w] += delta[n] * input[w];
+                    prev_delta[w] += delta[n] * weights[n*numAxon + w];
+                }
+                bias_gradient[n] += delta[n];
+            }
+            for (size_t w=0; w<numAxon; w++)
+                prev_delta[w] *= input[w] * (1 - input[w]);
+            delta = prev_delta;
+        }
+        template <size_t... L>
+        void backward(const Activations& activations, std::array<double, width>& delta, std::index_sequence<L...>) {
+            // from the output layer down to the first hidden layer
+            (backward_layer<numLayers-1-L>(activations, delta), ...);
+        }
+};
+
+// Write a static network to a checkpoint, in the same format as a dynamic one
+template <size_t... Sizes>
+void save_checkpoint(const StaticNetwork<Sizes...>& nn, const std::string& filename) {
+    std::unique_ptr<NeuralNetwork> dynamic(nn.dynamic());
+    save_checkpoint(*dynamic, filename);
+}
+// Read a checkpoint into a static network, throws std::invalid_argument when the layer sizes differ
+template <size_t... Sizes>
+void load_checkpoint(const std::string& filename, StaticNetwork<Sizes...>& nn) {
+    std::unique_ptr<NeuralNetwork> dynamic(load_checkpoint(filename));
+    nn = StaticNetwork<Sizes...>(*dynamic);
+}
+
+#endif
@@ -0,0 +1,181 @@
+#include "streaming_dataset.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+// Parsed chunks kept ahead of training
+static const size_t PREFETCH_DEPTH = 2;
+
+// Constructor for StreamingDataset
+StreamingDataset::StreamingDataset(const std::string& filenameIn, const CsvSchema& schemaIn, size_t chunkBytesIn,
+    size_t shuffleCapacityIn, double testFractionIn, uint64_t seedIn)
+    : filename(filenameIn), schema(schemaIn), chunkBytes(chunkBytesIn), shuffleCapacity(shuffleCapacityIn),
+      testFraction(testFractionIn), seed(seedIn) {
+    // detect the delimiter from the start of the file
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+        throw std::runtime_error("failed to open " + filename);
+    std::vector<char> head(4096);
+    file.read(head.data(), head.size());
+    delimiter = schema.delimiter ? schema.delimiter : detect_delimiter(head.data(), head.data() + file.gcount());
+
+    // one pass to find the shape and classes, so labels stay the same in every pass
+    for_each_chunk(schema, [this](Dataset& chunk, size_t) {
+        if (chunk.size() == 0) return;
+        if (numRows > 0 && chunk.numFeatures() != numFeatures)
+            throw std::runtime_error(filename + ": column count changes partway through the file");
+        numFeatures = chunk.numFeatures();
+        numRows += chunk.size();
+        if (schema.classes.empty())
+            classes = chunk.classes;
+    });
+    if (schema.classes.empty()) {
+        // order discovered classes like the in-memory loader does
+        Dataset order;
+        order.classes = classes;
+        sort_numeric_classes(order);
+        classes = order.classes;
+    } else {
+        classes = schema.classes;
+    }
+    schema.classes = classes; // later passes look labels up by name
+}
+
+// Read the file chunk by chunk, calling process on each parsed chunk and the index of its first row
+void StreamingDataset::for_each_chunk(const CsvSchema& chunkSchema, const std::function<void(Dataset&, size_t)>& process) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open())
+        throw std::runtime_error("failed to open " + filename);
+
+    std::vector<char> text;
+    std::vector<std::string> discovered = chunkSchema.classes;
+    size_t line = 1, row = 0;
+    while (!stopping && (file || !text.empty())) {
+        // append the next block after the partial line left from the last one
+        size_t carried = text.size();
+        text.resize(carried + chunkBytes);
+        file.read(text.data() + carried, chunkBytes);
+        text.resize(carried + file.gcount());
+
+        // parse up to the last complete line, everything at the end of the file
+        size_t end = text.size();
+        if (file) {
+            auto last = std::find(text.rbegin(), text.rend(), '\n');
+            if (last == text.rend()) continue; // a line longer than a chunk, keep reading
+            end = text.rend() - last;
+        }
+
+        Dataset chunk;
+        chunk.classes = discovered;
+        try {
+            parse_csv(text.data(), text.data() + end, delimiter, chunkSchema, chunk, line);
+        } catch (const std::runtime_error& e) {
+            throw std::runtime_error(filename + ": " + e.what());
+        }
+        discovered = chunk.classes;
+        line += std::count(text.begin(), text.begin() + end, '\n');
+
+        size_t first = row;
+        row += chunk.size();
+        process(chunk, first);
+
+        text.erase(text.begin(), text.begin() + end);
+        if (!file) break;
+    }
+}
+
+// Which side of the split a row falls on, decided by a hash of its index
+bool StreamingDataset::in_test(size_t row) const {
+    uint64_t x = row + seed;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return (x >> 11) * (1.0 / (1ull << 53)) < testFraction;
+}
+
+// Prefetch thread body, parses chunks ahead and keeps the rows of one partition
+void StreamingDataset::prefetch(Partition partition) {
+    try {
+        for_each_chunk(schema, [this, partition](Dataset& chunk, size_t first) {
+            std::vector<size_t> rows;
+            for (size_t i=0; i<chunk.size(); i++)
+                if (in_test(first+i) == (partition == TEST)) rows.push_back(i);
+
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [this]() {return stopping || ready.size() < PREFETCH_DEPTH;});
+            if (!stopping) ready.push_back(chunk.subset(rows));
+            changed.notify_all();
+        });
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        error = std::current_exception();
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    exhausted = true;
+    changed.notify_all();
+}
+
+// Stop the prefetch thread and drop anything it read
+void StreamingDataset::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    if (prefetcher.joinable()) prefetcher.join();
+    stopping = false;
+    ready.clear();
+}
+
+// Start a pass over one side of the split, every epoch shuffles differently
+void StreamingDataset::begin(Partition partition, size_t epoch) {
+    stop();
+    error = nullptr;
+    exhausted = false;
+    buffer = Dataset();
+    buffer.features.cols = numFeatures;
+    buffer.classes = classes;
+    rng = RandomStream(seed, STREAM_SHUFFLE).child(epoch*2 + (partition == TEST));
+    prefetcher = std::thread([this, partition]() {this->prefetch(partition);});
+}
+
+// Top up the shuffle buffer once it runs half empty, false when the pass is over and the buffer is empty
+bool StreamingDataset::fill_buffer() {
+    if (buffer.size() > shuffleCapacity/2) return true;
+    while (buffer.size() < shuffleCapacity) {
+        Dataset chunk;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [this]() {return exhausted || !ready.empty();});
+            if (error) std::rethrow_exception(error);
+            if (ready.empty()) break;
+            chunk = std::move(ready.front());
+            ready.pop_front();
+            changed.notify_all();
+        }
+        for (size_t i=0; i<chunk.size(); i++)
+            buffer.append(chunk.features[i], chunk.labels[i]);
+    }
+    return buffer.size() > 0;
+}
+
+// Fill batch with up to batchSize shuffled instances, false once the pass is over
+bool StreamingDataset::next(Dataset& batch, size_t batchSize) {
+    batch = Dataset();
+    batch.features.cols = numFeatures;
+    batch.classes = classes;
+
+    while (batch.size() < batchSize && fill_buffer()) {
+        // draw a random buffered instance and move the last one into its place
+        size_t pick = rng.below(buffer.size());
+        batch.append(buffer.features[pick], buffer.labels[pick]);
+
+        size_t last = buffer.size()-1;
+        std::copy(buffer.features[last], buffer.features[last] + numFeatures, buffer.features[pick]);
+        buffer.labels[pick] = buffer.labels[last];
+        buffer.labels.pop_back();
+        buffer.features.resize(last, numFeatures);
+    }
+    return batch.size() > 0;
+}
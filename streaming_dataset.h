@@ -0,0 +1,71 @@
+#ifndef STREAMING_DATASET_H
+#define STREAMING_DATASET_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <atomic>
+#include <functional>
+#include "dataset.h"
+#include "rng.h"
+
+// CSV dataset read in chunks, so it never has to fit in memory
+struct StreamingDataset {
+    public:
+        enum Partition {TRAIN, TEST};
+    private:
+        std::string filename;
+        CsvSchema schema;
+        char delimiter;
+        size_t chunkBytes;
+        size_t shuffleCapacity;
+        double testFraction;
+        uint64_t seed;
+
+        // parsed chunks of the current pass, filled by the prefetch thread
+        std::thread prefetcher;
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<Dataset> ready;
+        bool exhausted = true;
+        std::atomic<bool> stopping{false};
+        std::exception_ptr error;
+
+        // instances waiting to be drawn at random
+        Dataset buffer;
+        RandomStream rng;
+
+        // read the file chunk by chunk, calling process on each parsed chunk and the index of its first row
+        void for_each_chunk(const CsvSchema& chunkSchema, const std::function<void(Dataset&, size_t)>& process);
+        void prefetch(Partition partition); // prefetch thread body
+        bool in_test(size_t row) const; // which side of the split a row falls on
+        bool fill_buffer(); // top up the shuffle buffer, false when the pass is over
+        void stop();
+    public:
+        std::vector<std::string> classes;
+        size_t numFeatures = 0;
+        size_t numRows = 0;
+
+        // rows a pass over one side of the split is expected to return
+        size_t expected_rows(Partition partition) const {
+            return partition == TEST ? numRows*testFraction : numRows - (size_t)(numRows*testFraction);
+        }
+
+        // scans the file once up front to find the columns and classes
+        StreamingDataset(const std::string& filenameIn, const CsvSchema& schemaIn, size_t chunkBytesIn,
+            size_t shuffleCapacityIn, double testFractionIn, uint64_t seedIn);
+        ~StreamingDataset() {stop();}
+        StreamingDataset(const StreamingDataset&) = delete;
+        StreamingDataset& operator=(const StreamingDataset&) = delete;
+
+        // start a pass over one side of the split, every epoch shuffles differently
+        void begin(Partition partition, size_t epoch);
+        // fill batch with up to batchSize shuffled instances, false once the pass is over
+        bool next(Dataset& batch, size_t batchSize);
+};
+
+#endif
@@ -0,0 +1,79 @@
+#include "sweep.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+#include <stdexcept>
+
+// Trials for the grid or a random part of it
+std::vector<SweepTrial> sweep_trials(const SweepSpace& space, size_t numInputs, size_t numOutputs,
+    Activation outputActivation, RandomStream& random) {
+    if (space.grid_size() == 0)
+        throw std::invalid_argument("every setting needs at least one value to try");
+
+    // combinations are numbered, layers vary slowest then learn rate then iterations
+    std::vector<size_t> picks(space.grid_size());
+    std::iota(picks.begin(), picks.end(), 0);
+    if (space.samples && space.samples < picks.size()) {
+        shuffle(picks.data(), picks.size(), random);
+        picks.resize(space.samples);
+        std::sort(picks.begin(), picks.end());
+    }
+
+    std::vector<SweepTrial> trials(picks.size());
+    for (size_t t=0; t<picks.size(); t++) {
+        size_t index = picks[t];
+        size_t iterations = index % space.maxIterations.size();
+        index /= space.maxIterations.size();
+        size_t rate = index % space.learnRates.size();
+        size_t layers = index / space.learnRates.size();
+
+        SweepTrial& trial = trials[t];
+        trial.layerSizes.push_back(numInputs);
+        trial.layerSizes.insert(trial.layerSizes.end(), space.hiddenLayers[layers].begin(), space.hiddenLayers[layers].end());
+        trial.layerSizes.push_back(numOutputs);
+        trial.activations = space.hiddenActivations[layers];
+        trial.activations.push_back(outputActivation);
+        trial.learnRate = space.learnRates[rate];
+        trial.maxIteration = space.maxIterations[iterations];
+    }
+    return trials;
+}
+
+// Train every trial on the pool
+void run_sweep(std::vector<SweepTrial>& trials, const Optimizer& optimizer,
+    const DatasetView& trainset, const DatasetView& validation, const DatasetView& testset) {
+    // trial t is weight init run t, so the results don't depend on the thread count or the order trials run in
+    for (size_t t=0; t<trials.size(); t++) {
+        SweepTrial& trial = trials[t];
+        trial.network.reset(new NeuralNetwork(trial.layerSizes, trial.activations, t));
+        trial.network->optimizer = optimizer;
+        trial.network->quiet = true;
+    }
+
+    // idle threads claim the next untrained trial, the most expensive go first
+    // so a long one isn't left running alone at the end
+    std::vector<size_t> order(trials.size());
+    std::vector<double> cost(trials.size(), 0.0);
+    std::iota(order.begin(), order.end(), 0);
+    for (size_t t=0; t<trials.size(); t++)
+        for (size_t l=1; l<trials[t].layerSizes.size(); l++)
+            cost[t] += (double)trials[t].maxIteration * trials[t].layerSizes[l-1] * trials[t].layerSizes[l];
+    std::stable_sort(order.begin(), order.end(), [&cost](size_t a, size_t b) {return cost[a] > cost[b];});
+
+    // a trial's own learning steps run inline on the thread that took it
+    thread_pool().parallel_for(trials.size(), [&](size_t i) {
+        SweepTrial& trial = trials[order[i]];
+        auto start = std::chrono::steady_clock::now();
+        trial.network->train(trainset, validation, trial.maxIteration, trial.learnRate);
+        trial.loss = trial.network->loss(trainset);
+        trial.validationAccuracy = trial.network->test(validation);
+        trial.accuracy = trial.network->test(testset);
+        trial.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    });
+
+    // best validation accuracy first, ties go to the lower loss
+    std::stable_sort(trials.begin(), trials.end(), [](const SweepTrial& a, const SweepTrial& b) {
+        return a.validationAccuracy != b.validationAccuracy ? a.validationAccuracy > b.validationAccuracy : a.loss < b.loss;
+    });
+}
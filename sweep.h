@@ -0,0 +1,48 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include "neural_network.h"
+#include "dataset.h"
+#include "activation.h"
+#include "rng.h"
+
+// One combination of settings tried by a sweep, and how it did
+struct SweepTrial {
+    public:
+        std::vector<size_t> layerSizes; // including the input and output layers
+        std::vector<Activation> activations; // one per layer after the input
+        double learnRate;
+        size_t maxIteration;
+
+        double validationAccuracy = 0.0; // what the trials are ranked by
+        double accuracy = 0.0; // on the test set, only reported
+        double loss = 0.0; // on the training set
+        double seconds = 0.0; // wall time to train and test
+        std::unique_ptr<NeuralNetwork> network; // the trained network
+};
+
+// Values to try for every setting
+struct SweepSpace {
+    public:
+        std::vector<std::vector<size_t>> hiddenLayers; // sizes between the input and output layers
+        std::vector<std::vector<Activation>> hiddenActivations; // matching hiddenLayers
+        std::vector<double> learnRates;
+        std::vector<size_t> maxIterations;
+        size_t samples = 0; // random search over this many distinct combinations, 0 runs the whole grid
+
+        size_t grid_size() const {return hiddenLayers.size() * learnRates.size() * maxIterations.size();}
+};
+
+// Trials for the whole grid, or a random pick of samples combinations from it
+std::vector<SweepTrial> sweep_trials(const SweepSpace& space, size_t numInputs, size_t numOutputs,
+    Activation outputActivation, RandomStream& random);
+
+// Train a network for every trial, many at once on the thread pool, each sharing the same read-only rows
+// networks start from fresh weights and a copy of optimizer, trials come back ranked best first on the validation rows
+void run_sweep(std::vector<SweepTrial>& trials, const Optimizer& optimizer,
+    const DatasetView& trainset, const DatasetView& validation, const DatasetView& testset);
+
+#endif
@@ -0,0 +1,93 @@
+#include "telemetry.h"
+#include <cstdio>
+#include <stdexcept>
+#include <sys/resource.h>
+
+static const char* PHASE_NAMES[Telemetry::NUM_PHASES] = {"gradient", "apply_gradient", "loss", "test"};
+
+// Largest resident set size of the process so far, in kilobytes
+long peak_memory_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Constructor for Telemetry
+Telemetry::Telemetry(const std::string& logFile, const std::string& traceFile)
+    : log(logFile, std::ios::trunc), created(Clock::now()) {
+    if (!log.is_open())
+        throw std::runtime_error("failed to open " + logFile);
+    csv = logFile.size() >= 4 && logFile.compare(logFile.size()-4, 4, ".csv") == 0;
+    if (csv)
+        log << "run,epoch,seconds,samples_per_sec,gradient_seconds,apply_gradient_seconds,"
+            "loss_seconds,test_seconds,loss,accuracy,eval_epoch,peak_memory_kb\n";
+
+    if (!traceFile.empty()) {
+        trace.open(traceFile, std::ios::trunc);
+        if (!trace.is_open())
+            throw std::runtime_error("failed to open " + traceFile);
+        trace << "[\n";
+    }
+    for (auto& seconds : phaseSeconds) seconds = 0.0;
+}
+// Close the trace event array
+Telemetry::~Telemetry() {
+    if (trace.is_open()) trace << "\n]\n";
+}
+
+double Telemetry::microseconds(Clock::time_point time) const {
+    return std::chrono::duration<double, std::micro>(time - created).count();
+}
+
+// Add the time spent in a phase to the epoch and the trace
+void Telemetry::record(Phase phase, Clock::time_point start, Clock::time_point end, int thread) {
+    phaseSeconds[phase] += std::chrono::duration<double>(end - start).count();
+    if (!trace.is_open()) return;
+
+    char event[256];
+    snprintf(event, sizeof(event), "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.1f,\"dur\":%.1f,\"pid\":1,\"tid\":%d}",
+        firstEvent ? "" : ",\n", PHASE_NAMES[phase], microseconds(start), microseconds(end) - microseconds(start), thread);
+    trace << event;
+    firstEvent = false;
+}
+
+// An evaluation that finished during the epoch, on the trace thread of its own
+void Telemetry::evaluated(Clock::time_point start, Clock::time_point lossEnd, Clock::time_point end) {
+    record(LOSS, start, lossEnd, 2);
+    record(TEST, lossEnd, end, 2);
+}
+
+// Start of a call to train
+void Telemetry::begin_run() {
+    run++;
+}
+void Telemetry::begin_epoch() {
+    epochStart = Clock::now();
+    for (auto& seconds : phaseSeconds) seconds = 0.0;
+}
+// Write the epoch's timings and results
+void Telemetry::end_epoch(size_t epoch, size_t samples, double loss, double accuracy, size_t evalEpoch) {
+    Clock::time_point end = Clock::now();
+    double seconds = std::chrono::duration<double>(end - epochStart).count();
+    double throughput = seconds > 0 ? samples / seconds : 0.0;
+
+    char line[512];
+    if (csv)
+        snprintf(line, sizeof(line), "%zu,%zu,%.9f,%.1f,%.9f,%.9f,%.9f,%.9f,%.6f,%.6f,%zu,%ld\n",
+            run, epoch, seconds, throughput, phaseSeconds[GRADIENT], phaseSeconds[APPLY_GRADIENT],
+            phaseSeconds[LOSS], phaseSeconds[TEST], loss, accuracy, evalEpoch, peak_memory_kb());
+    else
+        snprintf(line, sizeof(line), "{\"run\":%zu,\"epoch\":%zu,\"seconds\":%.9f,\"samples_per_sec\":%.1f,"
+            "\"gradient_seconds\":%.9f,\"apply_gradient_seconds\":%.9f,\"loss_seconds\":%.9f,\"test_seconds\":%.9f,"
+            "\"loss\":%.6f,\"accuracy\":%.6f,\"eval_epoch\":%zu,\"peak_memory_kb\":%ld}\n",
+            run, epoch, seconds, throughput, phaseSeconds[GRADIENT], phaseSeconds[APPLY_GRADIENT],
+            phaseSeconds[LOSS], phaseSeconds[TEST], loss, accuracy, evalEpoch, peak_memory_kb());
+    log << line << std::flush;
+
+    if (trace.is_open()) {
+        snprintf(line, sizeof(line), "%s{\"name\":\"epoch %zu\",\"ph\":\"X\",\"ts\":%.1f,\"dur\":%.1f,\"pid\":1,\"tid\":0}",
+            firstEvent ? "" : ",\n", epoch, microseconds(epochStart), seconds*1e6);
+        trace << line << std::flush;
+        firstEvent = false;
+    }
+}
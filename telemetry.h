@@ -0,0 +1,55 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <string>
+#include <fstream>
+#include <chrono>
+
+// Records where training time goes, per epoch and per phase
+struct Telemetry {
+    public:
+        enum Phase {GRADIENT, APPLY_GRADIENT, LOSS, TEST, NUM_PHASES};
+        typedef std::chrono::steady_clock Clock;
+
+        // times a phase from construction to destruction, does nothing without telemetry
+        struct Scope {
+            private:
+                Telemetry* telemetry;
+                Phase phase;
+                Clock::time_point start;
+            public:
+                Scope(Telemetry* telemetryIn, Phase phaseIn)
+                    : telemetry(telemetryIn), phase(phaseIn), start(Clock::now()) {}
+                ~Scope() {if (telemetry) telemetry->record(phase, start, Clock::now());}
+        };
+    private:
+        std::ofstream log; // one line per epoch
+        bool csv; // CSV when the log file ends in .csv, JSON lines otherwise
+        std::ofstream trace; // Chrome trace events, if requested
+        bool firstEvent = true;
+
+        Clock::time_point created;
+        Clock::time_point epochStart;
+        double phaseSeconds[NUM_PHASES];
+        size_t run = 0;
+
+        void record(Phase phase, Clock::time_point start, Clock::time_point end, int thread = 1);
+        double microseconds(Clock::time_point time) const;
+    public:
+        // throws std::runtime_error when a file can't be opened
+        Telemetry(const std::string& logFile, const std::string& traceFile = "");
+        ~Telemetry();
+
+        void begin_run(); // start of a call to train
+        void begin_epoch();
+        // loss and accuracy come from the evaluation of evalEpoch, which can lag behind epoch
+        void end_epoch(size_t epoch, size_t samples, double loss, double accuracy, size_t evalEpoch);
+        // an evaluation that finished during the epoch, its loss ran from start to lossEnd then its test until end
+        // kept on a trace thread of its own since it can overlap training
+        void evaluated(Clock::time_point start, Clock::time_point lossEnd, Clock::time_point end);
+};
+
+// Largest resident set size of the process so far, in kilobytes
+long peak_memory_kb();
+
+#endif
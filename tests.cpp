@@ -0,0 +1,201 @@
+#include "config.h"
+#include "neural_network.h"
+#include "checkpoint.h"
+#include "dataset.h"
+#include "activation.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+Correctness checks for the numerics and file formats, prints every failure
+  make check, or ./tests from the repository root so the bundled datasets are found
+*/
+
+static size_t failures = 0;
+
+// Report a failed check and keep going, so one run shows everything that broke
+static void check(bool ok, const std::string& what) {
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what.c_str());
+        failures++;
+    }
+}
+
+// Small numbers in scientific notation, for failure messages
+static std::string scientific(double x) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.3e", x);
+    return text;
+}
+
+// Whole file as bytes, and back
+static std::vector<char> read_file(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+static void write_file(const std::string& filename, const std::vector<char>& bytes) {
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    file.write(bytes.data(), bytes.size());
+}
+
+// Whether loading a checkpoint throws std::runtime_error
+static bool load_fails(const std::string& filename) {
+    try {
+        delete load_checkpoint(filename, false);
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+// Checkpoints keep every parameter, activation and the normalization, pruned layers as CSR
+static void test_checkpoint() {
+    const std::string filename = "tests_checkpoint.bin";
+    NeuralNetwork nn({4, 32, 16, 3}, {RELU, TANH, SOFTMAX}, 7);
+    nn.normalization.type = ZSCORE;
+    nn.normalization.shift = {5.8, 3.0, 3.7, 1.2};
+    nn.normalization.scale = {1.2, 2.3, 0.6, 1.3};
+    nn.layers[2]->prune(nn.layers[2]->sparsity_threshold(0.9)); // CSR is smaller, layer 1 and 3 stay dense
+    save_checkpoint(nn, filename);
+
+    for (bool mapped : {true, false}) {
+        NeuralNetwork* loaded = load_checkpoint(filename, mapped);
+        bool same = loaded->layers.size() == nn.layers.size() && loaded->normalization == nn.normalization;
+        for (size_t l=0; same && l<nn.layers.size(); l++) {
+            const Layer* a = nn.layers[l], *b = loaded->layers[l];
+            same = a->activation == b->activation && a->nodes.size() == b->nodes.size() &&
+                std::equal(a->weights.begin(), a->weights.end(), b->weights.begin()) &&
+                std::equal(a->biases.begin(), a->biases.end(), b->biases.begin()) &&
+                a->sparse.values.size() == b->sparse.values.size();
+        }
+        check(same, std::string("checkpoint round trip, ") + (mapped ? "mapped" : "copied"));
+        delete loaded;
+    }
+
+    // the pruned layer takes less room than it would dense
+    std::vector<size_t> layerSizes = {4, 32, 16, 3};
+    size_t normalizationOffset;
+    std::vector<size_t> weightOffsets, biasOffsets;
+    std::vector<char> bytes = read_file(filename);
+    check(bytes.size() < checkpoint_layout(layerSizes, {}, normalizationOffset, weightOffsets, biasOffsets),
+        "checkpoint stores the pruned layer as CSR");
+
+    // a column index past the layer's inputs, a truncated file and a wrong magic are all rejected
+    std::vector<uint64_t> storedWeights = {CHECKPOINT_DENSE, CHECKPOINT_DENSE, nn.layers[2]->sparse.values.size(),
+        CHECKPOINT_DENSE};
+    checkpoint_layout(layerSizes, storedWeights, normalizationOffset, weightOffsets, biasOffsets);
+    size_t columnsOffset = (weightOffsets[2] + 17*sizeof(uint64_t) + CHECKPOINT_ALIGNMENT-1) /
+        CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT;
+    std::vector<char> corrupted = bytes;
+    uint32_t column = 32;
+    std::memcpy(corrupted.data() + columnsOffset, &column, sizeof(column));
+    write_file(filename, corrupted);
+    check(load_fails(filename), "checkpoint with a sparse column out of range is rejected");
+
+    write_file(filename, std::vector<char>(bytes.begin(), bytes.begin() + bytes.size()/2));
+    check(load_fails(filename), "truncated checkpoint is rejected");
+
+    corrupted = bytes;
+    corrupted[0] = 'X';
+    write_file(filename, corrupted);
+    check(load_fails(filename), "checkpoint with a bad magic is rejected");
+    std::remove(filename.c_str());
+}
+
+// The dataset cache gives back what parsing gives, and a damaged cache is rebuilt rather than trusted
+static void test_dataset_cache() {
+    const std::string filename = "tests_dataset.csv", cachename = filename + ".cache";
+    write_file(filename, read_file("datasets/iris.csv"));
+    std::remove(cachename.c_str());
+    CsvSchema schema;
+    schema.normalization = ZSCORE;
+
+    Dataset parsed = get_dataset(filename, schema);
+    auto same = [&parsed](const Dataset& dataset) {
+        return dataset.features.data == parsed.features.data && dataset.labels == parsed.labels &&
+            dataset.classes == parsed.classes && dataset.normalization == parsed.normalization;
+    };
+    check(same(get_dataset_cached(filename, schema)), "dataset cache miss parses the file");
+    check(read_file(cachename).size() > 0, "dataset cache is written");
+    check(same(get_dataset_cached(filename, schema)), "dataset cache hit round trip");
+
+    // the first class name's length runs far past the end of the cache
+    std::vector<char> bytes = read_file(cachename);
+    uint64_t length = 1ull << 40;
+    std::memcpy(bytes.data() + 72, &length, sizeof(length));
+    write_file(cachename, bytes);
+    check(same(get_dataset_cached(filename, schema)), "dataset cache with a bad class name length is rebuilt");
+
+    bytes = read_file(cachename);
+    write_file(cachename, std::vector<char>(bytes.begin(), bytes.begin() + 100));
+    check(same(get_dataset_cached(filename, schema)), "truncated dataset cache is rebuilt");
+    std::remove(filename.c_str());
+    std::remove(cachename.c_str());
+}
+
+// Largest relative error of the activations' exp against std::exp over [-range, range]
+// a softmax row of x and zeros gives exp(x) as the ratio of two of its outputs, x sits in both
+// the vector part and the scalar tail of the row, the two roundings of the normalization are within tolerance
+template <class T>
+static double exp_error(double range) {
+    const size_t cols = 11;
+    double worst = 0.0;
+    for (double x=-range; x<=range; x+=range/1000) {
+        for (size_t position : {(size_t)0, cols-1}) {
+            std::vector<T> row(cols, 0);
+            row[position] = (T)x;
+            activate(SOFTMAX, row.data(), cols);
+            double ratio = (double)row[position] / (double)row[position ? 0 : 1];
+            double expected = std::exp((double)(T)x);
+            worst = std::max(worst, std::abs(ratio - expected) / expected);
+        }
+    }
+    return worst;
+}
+static void test_exp() {
+    double error = exp_error<double>(300.0);
+    check(error < 1e-14, "double exp relative error " + scientific(error) + " within 1e-14");
+    error = exp_error<float>(40.0);
+    check(error < 3e-7 + 2*FLT_EPSILON, "float exp relative error " + scientific(error) + " within 3e-7");
+}
+
+// Backpropagation agrees with finite differences, for dense and pruned networks
+static void test_gradient() {
+    CsvSchema schema;
+    schema.normalization = ZSCORE;
+    Dataset iris = get_dataset("datasets/iris.csv", schema);
+    std::vector<size_t> rows;
+    for (size_t i=0; i<iris.size(); i+=5) rows.push_back(i);
+    DatasetView sample(iris, rows);
+
+    NeuralNetwork squared({4, 8, 3}, {SIGMOID, SIGMOID}, 1);
+    double deviation = squared.gradient_check(sample);
+    check(deviation < 1e-6, "sigmoid squared error gradient deviation " + scientific(deviation));
+
+    NeuralNetwork softmax({4, 8, 8, 3}, {TANH, TANH, SOFTMAX}, 2);
+    deviation = softmax.gradient_check(sample);
+    check(deviation < 1e-6, "softmax cross-entropy gradient deviation " + scientific(deviation));
+
+    softmax.prune_sparsity(0.8);
+    deviation = softmax.gradient_check(sample);
+    check(deviation < 1e-6, "pruned network gradient deviation " + scientific(deviation));
+}
+
+int main() {
+    test_checkpoint();
+    test_dataset_cache();
+    test_exp();
+    test_gradient();
+
+    if (failures) fprintf(stderr, "%zu checks failed\n", failures);
+    else fprintf(stderr, "all checks passed\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+#include "config.h"
+#include "thread_pool.h"
+
+// Set on pool workers so nested loops run inline instead of deadlocking
+static thread_local bool inside_worker = false;
+
+// Constructor for ThreadPool
+ThreadPool::ThreadPool(size_t numThreads) {
+    resize(numThreads);
+}
+
+// Change the number of threads, 0 uses every hardware thread
+void ThreadPool::resize(size_t numThreads) {
+    if (numThreads == 0)
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::lock_guard<std::mutex> running(busy);
+    stop();
+    stopping = false;
+    for (size_t i=1; i<numThreads; i++)
+        workers.push_back(std::thread([this]() {this->work();}));
+}
+
+// Join all worker threads
+void ThreadPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers)
+        worker.join();
+    workers.clear();
+}
+
+// Worker thread body
+void ThreadPool::work() {
+    inside_worker = true;
+    size_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this, seen]() {return stopping || generation != seen;});
+            if (stopping) return;
+            seen = generation;
+        }
+        run_tasks();
+    }
+}
+
+// Claim and run iterations until none are left
+void ThreadPool::run_tasks() {
+    while (true) {
+        size_t i;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (nextTask >= numTasks) return;
+            i = nextTask++;
+        }
+
+        try {
+            (*task)(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) error = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--remaining == 0) finished.notify_all();
+    }
+}
+
+// Run task(i) for every i in [0, count) and wait for all of them to finish
+void ThreadPool::parallel_for(size_t count, const std::function<void(size_t)>& taskIn) {
+    // run inline when nested in a worker, single threaded, or already in use by another caller
+    std::unique_lock<std::mutex> running(busy, std::defer_lock);
+    if (inside_worker || workers.empty() || count <= 1 || !running.try_lock()) {
+        for (size_t i=0; i<count; i++) taskIn(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        task = &taskIn;
+        numTasks = count;
+        nextTask = 0;
+        remaining = count;
+        error = nullptr;
+        generation++;
+    }
+    wake.notify_all();
+
+    // the calling thread helps out, then waits for the stragglers
+    inside_worker = true;
+    run_tasks();
+    inside_worker = false;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this]() {return remaining == 0;});
+    task = nullptr;
+    if (error) std::rethrow_exception(error);
+}
+
+// Pool shared by the whole program, sized by TRAIN_THREADS
+ThreadPool& thread_pool() {
+    static ThreadPool pool(TRAIN_THREADS);
+    return pool;
+}
+
+// Pretend to be a worker, so parallel_for never takes the pool
+void run_loops_inline() {
+    inside_worker = true;
+}
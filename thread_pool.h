@@ -0,0 +1,51 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+// Pool of worker threads that run the iterations of a loop in parallel
+struct ThreadPool {
+    private:
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::mutex busy; // held while a loop is running on the pool
+        std::condition_variable wake;
+        std::condition_variable finished;
+
+        // state of the loop currently running
+        const std::function<void(size_t)>* task = nullptr;
+        size_t numTasks = 0;
+        size_t nextTask = 0;
+        size_t remaining = 0;
+        size_t generation = 0;
+        std::exception_ptr error;
+        bool stopping = false;
+
+        void work(); // worker thread body
+        void run_tasks(); // claim and run iterations until none are left
+        void stop();
+    public:
+        ThreadPool(size_t numThreads);
+        ~ThreadPool() {stop();}
+
+        // number of threads taking part in a loop, including the caller
+        size_t size() const {return workers.size()+1;}
+        void resize(size_t numThreads);
+
+        // run task(i) for every i in [0, count) and wait for all of them to finish
+        void parallel_for(size_t count, const std::function<void(size_t)>& task);
+};
+
+// Pool shared by the whole program, sized by TRAIN_THREADS
+ThreadPool& thread_pool();
+
+// Loops the calling thread starts from now on run inline, for background threads
+// that would otherwise hold the pool and leave the training thread to run its loops alone
+void run_loops_inline();
+
+#endif